@@ -1,95 +1,113 @@
 #include "abd_client.h"
 #include "../common/network.h"
-#include <thread>
+#include "../common/protocol.h"
+#include "../common/health.h"
+#include "../common/ownership.h"
+#include "../common/quorum.h"
+#include "../common/single_flight.h"
+#include "../common/trace.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <sstream>
-#include <numeric>
 #include <vector>
-#include <unistd.h>
 
 using namespace std;
 
 namespace ABD {
 
-void read_task(
-    int i,
-    const string &key,
-    const vector<int> &servers_idx,
-    const vector<ServerInfo> &servers,
-    vector<ReadResp> &out)
-{
-    int idx = servers_idx[i];
-    int sock = Network::connect_to_server(servers[idx]);
-    if (sock < 0) {
-        out[i].valid = false;
-        return;
-    }
+// SWMR state shared by every client in the process
+static Ownership::Table owners;
+static mutex owner_lock;
+static map<string, int> owned_tags;     // key -> last tag this process wrote; guarded by owner_lock
 
-    string req = "READ_REQ " + key + "\n";
-    if (!Network::send_message(sock, req)) {
-        close(sock);
-        out[i].valid = false;
-        return;
-    }
+static bool valid_read_resp(const string &line) {
+    ReadResp r;
+    return Protocol::parse_read_resp(line, r);
+}
 
-    string resp = Network::recv_line(sock);
-    close(sock);
+int read_quorum(const Quorums &q, int n)
+{
+    return q.read > 0 ? q.read : n/2 + 1;
+}
 
-    istringstream iss(resp);
-    string pfx;
-    int tlc, tcid;
-    string val;
+int write_quorum(const Quorums &q, int n)
+{
+    return q.write > 0 ? q.write : n/2 + 1;
+}
 
-    // parse the server's response
-    if (!(iss >> pfx >> tlc >> tcid) || pfx != "READ_RESP") {
-        out[i].valid = false;
-        return;
-    }
-    iss >> ws;
-    getline(iss, val);
+bool check_quorums(const Quorums &q, int n, string &err)
+{
+    int R = read_quorum(q, n);
+    int W = write_quorum(q, n);
+    ostringstream oss;
 
-    out[i] = {tlc, tcid, val, true};
+    if (R < 1 || R > n || W < 1 || W > n) {
+        oss << "quorum sizes must be between 1 and N=" << n;
+    } else if (R + W <= n) {
+        oss << "R=" << R << " W=" << W << ": R + W must exceed N=" << n << " or reads can miss writes";
+    } else if (2*W <= n) {
+        oss << "W=" << W << ": W must exceed N/2 or concurrent writes can miss each other";
+    }
+    err = oss.str();
+    return err.empty();
 }
 
-static vector<ReadResp> read_phase(const string &key, const vector<int> &servers_idx, const vector<ServerInfo> &servers)
+// Query replicas from order until R answered; answered gets their indices
+static vector<ReadResp> read_phase(const string &key, int R, const vector<int> &order, const vector<ServerInfo> &servers, vector<int> &answered)
 {
-    int R = servers_idx.size();
-    vector<ReadResp>out(R);
-    vector<thread>threads;
-    threads.reserve(R);
+    auto replies = Quorum::call(servers, order, R, Protocol::read_req(key), Trace::READ, valid_read_resp);
 
-    for (int i = 0; i < R; i++) {
-        threads.emplace_back([&, i]() {
-            read_task(i, key, servers_idx, servers, out);
-        });
+    vector<ReadResp> out(replies.size());
+    for (size_t i = 0; i < replies.size(); i++) {
+        Protocol::parse_read_resp(replies[i].line, out[i]);
+        answered.push_back(replies[i].replica);
     }
-
-    for (auto &t : threads) t.join();
     return out;
 }
 
-static void write_phase(const string &key, int tag_lamport, int tag_cid, const string &value, const vector<int> &servers_idx, const vector<ServerInfo> &servers)
+// Store the tagged value on W replicas from order
+static bool write_phase(const string &key, int tag_lamport, int tag_cid, const string &value, int W, const vector<int> &order, const vector<ServerInfo> &servers)
 {
-    vector<thread> threads;
-    threads.reserve(servers_idx.size());
+    auto acks = Quorum::call(servers, order, W, Protocol::write_req(key, tag_lamport, tag_cid, value), Trace::WRITE,
+                             [](const string &line) { return line == "ACK"; });
+    return (int)acks.size() >= W;
+}
 
-    for (int i : servers_idx) {
-        threads.emplace_back([&, i]() {
-            int sock = Network::connect_to_server(servers[i]);
-            if (sock < 0) return;
+static Async::Task<vector<ReadResp>> read_phase_async(const string &key, int R, const vector<int> &order, const vector<ServerInfo> &servers, vector<int> &answered)
+{
+    auto replies = co_await Quorum::call_async(servers, order, R, Protocol::read_req(key), valid_read_resp);
 
-            ostringstream oss;
-            oss << "WRITE_REQ " << key << " " << tag_lamport << " " 
-                << tag_cid << " " << value << "\n";
+    vector<ReadResp> out(replies.size());
+    for (size_t i = 0; i < replies.size(); i++) {
+        Protocol::parse_read_resp(replies[i].line, out[i]);
+        answered.push_back(replies[i].replica);
+    }
+    co_return out;
+}
 
-            Network::send_message(sock, oss.str());
-            Network::recv_line(sock);
-            close(sock);
-        });
+static Async::Task<bool> write_phase_async(const string &key, int tag_lamport, int tag_cid, const string &value, int W, const vector<int> &order, const vector<ServerInfo> &servers)
+{
+    auto acks = co_await Quorum::call_async(servers, order, W, Protocol::write_req(key, tag_lamport, tag_cid, value),
+                                            [](const string &line) { return line == "ACK"; });
+    co_return (int)acks.size() >= W;
+}
+
+// Replicas in first, then the rest of order, leaving out those in skip
+static vector<int> prefer(const vector<int> &first, const vector<int> &order, const vector<int> &skip = {})
+{
+    vector<int> out;
+    for (int i : first) {
+        if (find(skip.begin(), skip.end(), i) == skip.end()) out.push_back(i);
+    }
+    for (int i : order) {
+        if (find(first.begin(), first.end(), i) == first.end() &&
+            find(skip.begin(), skip.end(), i) == skip.end()) out.push_back(i);
     }
-    for (auto &t : threads) t.join();
+    return out;
 }
 
-static bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, string &best_val)
+bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, string &best_val)
 {
     int best_i = -1;
     for (int i = 0; i < R; i++) {
@@ -102,23 +120,90 @@ static bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti,
             best_i = i;
             best_ti = resps[i].t_int;
             best_tc = resps[i].t_client;
-            best_val = resps[i].value;
         }
     }
+    // values can be large: copy only the winner
+    if (best_i != -1) best_val = resps[best_i].value;
     return best_i != -1;
 }
 
-bool get(const string &key, int /*client_id*/, const vector<ServerInfo> &servers, string &out)
+static bool get_once(const string &key, int client_id, const vector<ServerInfo> &servers, const Quorums &q, string &out);
+
+// Answered replicas already holding tag (ti, tc); they count toward the
+// write-back quorum, as tags only grow
+static vector<int> holding(const vector<ReadResp> &resps, const vector<int> &answered, int R, int ti, int tc)
 {
+    vector<int> out;
+    for (int i = 0; i < R; i++) {
+        if (resps[i].t_int == ti && resps[i].t_client == tc) out.push_back(answered[i]);
+    }
+    return out;
+}
+
+// The owner is the only writer, so its own counter is the max tag. Next
+// tag of an owned key, or -1 before this process first writes it.
+static int next_owned_tag(const string &key)
+{
+    lock_guard<mutex> guard(owner_lock);
+    auto it = owned_tags.find(key);
+    return it != owned_tags.end() ? ++it->second : -1;
+}
+
+// Next tag of an owned key given the highest tag read from the replicas
+static int first_owned_tag(const string &key, int max_ti)
+{
+    lock_guard<mutex> guard(owner_lock);
+    auto it = owned_tags.emplace(key, max_ti).first;
+    it->second = max(it->second, max_ti);
+    return ++it->second;
+}
+
+bool declare_owner(const string &prefix, int owner, const vector<ServerInfo> &servers)
+{
+    vector<int> all(servers.size());
+    for (size_t i = 0; i < all.size(); i++) all[i] = i;
+
+    auto acks = Quorum::call(servers, all, all.size(), Protocol::own_req(prefix, owner), Trace::WRITE,
+                             [](const string &line) { return line == "ACK"; });
+    if (acks.size() != servers.size()) {
+        return false;
+    }
+    return owners.add(prefix, owner);
+}
+
+bool get(const string &key, int client_id, const vector<ServerInfo> &servers, string &out)
+{
+    return get(key, client_id, servers, Quorums(), out);
+}
+
+bool get(const string &key, int client_id, const vector<ServerInfo> &servers, const Quorums &q, string &out)
+{
+    // concurrent GETs of the same key with the same quorums can share one run
     int N = servers.size();
-    int R = N/2 + 1;
+    string flight = "abd/" + to_string(read_quorum(q, N)) + "/" + to_string(write_quorum(q, N)) + "/" + key;
+    return SingleFlight::run(flight, [&](string &value) { return get_once(key, client_id, servers, q, value); }, out);
+}
 
-    vector<int> idxs;
-    for (int i=0; i<R; i++) {
-        idxs.push_back(i);
+static bool get_once(const string &key, int client_id, const vector<ServerInfo> &servers, const Quorums &q, string &out)
+{
+    Trace::Op op(Trace::GET, client_id);
+    int N = servers.size();
+    int R = read_quorum(q, N);
+    int W = write_quorum(q, N);
+
+    string err;
+    if (!check_quorums(q, N, err)) {
+        return false;
     }
 
-    auto resps = read_phase(key, idxs, servers);
+    // healthy replicas first; failed ones get replaced by the next in line
+    vector<int> order = Health::preferred_order(servers);
+    vector<int> answered;
+
+    auto resps = read_phase(key, R, order, servers, answered);
+    if ((int)resps.size() < R) {
+        return false;
+    }
 
     int best_ti = -1, best_tc = -1;
     string best_val;
@@ -126,23 +211,85 @@ bool get(const string &key, int /*client_id*/, const vector<ServerInfo> &servers
     if (!find_highest_tag(resps, R, best_ti, best_tc, best_val)) {
         return false;
     }
+    out = move(best_val);
+
+    // with W replicas at the highest tag the write-back is not needed. Every
+    // replica starts at the (0, 0) tag, so a key never written needs none;
+    // replicas would refuse it for an owned key anyway.
+    vector<int> current = holding(resps, answered, R, best_ti, best_tc);
 
-    out = best_val;
-    write_phase(key, best_ti, best_tc, out, idxs, servers);
+    int missing = best_ti == 0 && best_tc == 0 ? 0 : W - (int)current.size();
+    if (missing > 0 && !write_phase(key, best_ti, best_tc, out, missing, prefer(answered, order, current), servers)) {
+        return false;
+    }
+    op.set_ok(true);
     return true;
 }
 
+bool get(const string &key, int client_id, const Partition::Groups &groups, const Quorums &q, string &out)
+{
+    int g = groups.group_of(key);
+    Trace::GroupScope scope(g);
+    return get(key, client_id, groups.group(g), q, out);
+}
+
+bool put(const string &key, const string &value, int client_id, const Partition::Groups &groups, const Quorums &q)
+{
+    int g = groups.group_of(key);
+    Trace::GroupScope scope(g);
+    return put(key, value, client_id, groups.group(g), q);
+}
+
 bool put(const string &key, const string &value, int client_id, const vector<ServerInfo> &servers)
 {
+    return put(key, value, client_id, servers, Quorums());
+}
+
+bool put(const string &key, const string &value, int client_id, const vector<ServerInfo> &servers, const Quorums &q)
+{
+    Trace::Op op(Trace::PUT, client_id);
     int N = servers.size();
-    int R = N/2 + 1;
+    int R = read_quorum(q, N);
+    int W = write_quorum(q, N);
 
-    vector<int> idxs;
-    for (int i=0; i<R; i++) {
-        idxs.push_back(i);
+    string err;
+    if (!check_quorums(q, N, err)) {
+        return false;
     }
 
-    auto resps = read_phase(key, idxs, servers);
+    vector<int> order = Health::preferred_order(servers);
+    vector<int> answered;
+
+    int owner = owners.owner_of(key);
+    if (owner != -1 && owner != client_id) {
+        return false;
+    }
+    if (owner == client_id) {
+        // only the first write since startup has to ask the replicas
+        int tag = next_owned_tag(key);
+        if (tag < 0) {
+            auto resps = read_phase(key, R, order, servers, answered);
+            if ((int)resps.size() < R) {
+                return false;
+            }
+            int max_ti = -1, max_tc = -1;
+            string dummy;
+            find_highest_tag(resps, R, max_ti, max_tc, dummy);
+            tag = first_owned_tag(key, max_ti);
+        }
+
+        if (!write_phase(key, tag, client_id, value, W, prefer(answered, order), servers)) {
+            return false;
+        }
+        op.set_ok(true);
+        return true;
+    }
+
+    // the query phase only has to meet the last write, so R replicas do
+    auto resps = read_phase(key, R, order, servers, answered);
+    if ((int)resps.size() < R) {
+        return false;
+    }
 
     int max_ti = -1, max_tc = -1;
     string dummy;
@@ -151,8 +298,89 @@ bool put(const string &key, const string &value, int client_id, const vector<Ser
     int new_ti = max_ti + 1;
     int new_tc = client_id;
 
-    write_phase(key, new_ti, new_tc, value, idxs, servers);
+    if (!write_phase(key, new_ti, new_tc, value, W, prefer(answered, order), servers)) {
+        return false;
+    }
+    op.set_ok(true);
     return true;
 }
 
-}
\ No newline at end of file
+// client_id only names traced ops, and coroutine ops are not traced
+Async::Task<bool> get_async(const string &key, int, const vector<ServerInfo> &servers, const Quorums &q, string &out)
+{
+    int N = servers.size();
+    int R = read_quorum(q, N);
+    int W = write_quorum(q, N);
+
+    string err;
+    if (!check_quorums(q, N, err)) {
+        co_return false;
+    }
+
+    vector<int> order = Health::preferred_order(servers);
+    vector<int> answered;
+
+    auto resps = co_await read_phase_async(key, R, order, servers, answered);
+    if ((int)resps.size() < R) {
+        co_return false;
+    }
+
+    int best_ti = -1, best_tc = -1;
+    string best_val;
+
+    if (!find_highest_tag(resps, R, best_ti, best_tc, best_val)) {
+        co_return false;
+    }
+    out = move(best_val);
+
+    vector<int> current = holding(resps, answered, R, best_ti, best_tc);
+    int missing = best_ti == 0 && best_tc == 0 ? 0 : W - (int)current.size();
+    if (missing <= 0) co_return true;
+    co_return co_await write_phase_async(key, best_ti, best_tc, out, missing, prefer(answered, order, current), servers);
+}
+
+Async::Task<bool> put_async(const string &key, const string &value, int client_id, const vector<ServerInfo> &servers, const Quorums &q)
+{
+    int N = servers.size();
+    int R = read_quorum(q, N);
+    int W = write_quorum(q, N);
+
+    string err;
+    if (!check_quorums(q, N, err)) {
+        co_return false;
+    }
+
+    vector<int> order = Health::preferred_order(servers);
+    vector<int> answered;
+
+    int owner = owners.owner_of(key);
+    if (owner != -1 && owner != client_id) {
+        co_return false;
+    }
+
+    int new_ti = owner == client_id ? next_owned_tag(key) : -1;
+    if (new_ti < 0) {
+        auto resps = co_await read_phase_async(key, R, order, servers, answered);
+        if ((int)resps.size() < R) {
+            co_return false;
+        }
+        int max_ti = -1, max_tc = -1;
+        string dummy;
+        find_highest_tag(resps, R, max_ti, max_tc, dummy);
+        new_ti = owner == client_id ? first_owned_tag(key, max_ti) : max_ti + 1;
+    }
+
+    co_return co_await write_phase_async(key, new_ti, client_id, value, W, prefer(answered, order), servers);
+}
+
+Async::Task<bool> get_async(const string &key, int client_id, const Partition::Groups &groups, const Quorums &q, string &out)
+{
+    return get_async(key, client_id, groups.servers_for(key), q, out);
+}
+
+Async::Task<bool> put_async(const string &key, const string &value, int client_id, const Partition::Groups &groups, const Quorums &q)
+{
+    return put_async(key, value, client_id, groups.servers_for(key), q);
+}
+
+}
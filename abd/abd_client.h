@@ -1,9 +1,50 @@
 #pragma once
 #include "../common/types.h"
+#include "../common/async.h"
+#include "../common/partition.h"
+#include <string>
 #include <vector>
 
 namespace ABD {
+    // Read and write quorum sizes of one client; 0 means a majority
+    struct Quorums {
+        int read = 0;
+        int write = 0;
+    };
+
+    // Actual sizes for n replicas
+    int read_quorum(const Quorums &q, int n);
+    int write_quorum(const Quorums &q, int n);
+
+    // Safe when R + W > N, so every read meets the latest write, and
+    // W > N/2, so any two writes meet. Otherwise err says why.
+    bool check_quorums(const Quorums &q, int n, std::string &err);
+
+    // Single-writer (SWMR) mode: keys starting with prefix are written only
+    // by owner, whose PUTs then take one round trip with a tag counter kept
+    // in this process instead of a query phase. Every replica must accept
+    // the declaration; they then reject writes tagged by anyone else. Call
+    // before the prefix is first written.
+    bool declare_owner(const std::string &prefix, int owner, const std::vector<ServerInfo> &servers);
+
     bool get(const std::string &key, int client_id, const std::vector<ServerInfo> &servers, std::string &out_value);
-    
+    bool get(const std::string &key, int client_id, const std::vector<ServerInfo> &servers, const Quorums &q, std::string &out_value);
+
     bool put(const std::string &key, const std::string &value, int client_id, const std::vector<ServerInfo> &servers);
+    bool put(const std::string &key, const std::string &value, int client_id, const std::vector<ServerInfo> &servers, const Quorums &q);
+
+    // Run on the replica group that owns key; q applies within the group
+    bool get(const std::string &key, int client_id, const Partition::Groups &groups, const Quorums &q, std::string &out_value);
+    bool put(const std::string &key, const std::string &value, int client_id, const Partition::Groups &groups, const Quorums &q);
+
+    // The same GET and PUT as coroutines on the current Async::Loop, so one
+    // thread can run many clients. Concurrent GETs are not coalesced and
+    // phases are not hedged or traced.
+    Async::Task<bool> get_async(const std::string &key, int client_id, const std::vector<ServerInfo> &servers, const Quorums &q, std::string &out_value);
+    Async::Task<bool> put_async(const std::string &key, const std::string &value, int client_id, const std::vector<ServerInfo> &servers, const Quorums &q);
+    Async::Task<bool> get_async(const std::string &key, int client_id, const Partition::Groups &groups, const Quorums &q, std::string &out_value);
+    Async::Task<bool> put_async(const std::string &key, const std::string &value, int client_id, const Partition::Groups &groups, const Quorums &q);
+
+    // Pick the response with the highest (t_int, t_client) tag among the first R
+    bool find_highest_tag(const std::vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, std::string &best_val);
 }
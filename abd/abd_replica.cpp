@@ -0,0 +1,217 @@
+#include "abd_replica.h"
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include "../common/hash.h"
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ABD {
+
+int Replica::range_of(const string &key) {
+    return Hash::fnv1a(key) % SYNC_RANGES;
+}
+
+void Replica::toggle_digest(const string &key, const KeyState &ks) {
+    // the (0, 0) tag means never written and is left out
+    if (ks.tag_lamport == 0 && ks.tag_cid == 0) return;
+    uint64_t h = Hash::mix(Hash::fnv1a(key) ^ Hash::mix(((uint64_t)(uint32_t)ks.tag_lamport << 32) | (uint32_t)ks.tag_cid));
+    digests[range_of(key)] ^= h;
+}
+
+Replica::Replica(int partitions) : shards(max(partitions, 1)) {}
+
+uint64_t Replica::root_digest() {
+    uint64_t root = 0;
+    for (uint64_t d : range_digests()) root = Hash::mix(root ^ d);
+    return root;
+}
+
+vector<uint64_t> Replica::range_digests() {
+    vector<uint64_t> out(SYNC_RANGES);
+    for (size_t s = 0; s < shards.size(); s++) {
+        Stats::TimedLock guard(shards[s].lock, server_stats);
+        for (int r = s; r < SYNC_RANGES; r += shards.size()) out[r] = digests[r];
+    }
+    return out;
+}
+
+vector<Replica::TagEntry> Replica::range_entries(const vector<int> &ranges) {
+    bool wanted[SYNC_RANGES] = {};
+    for (int r : ranges) {
+        if (r >= 0 && r < SYNC_RANGES) wanted[r] = true;
+    }
+
+    vector<TagEntry> out;
+    for (Shard &sh : shards) {
+        Stats::TimedLock guard(sh.lock, server_stats);
+        for (auto &kv_pair : sh.kv) {
+            const KeyState &ks = kv_pair.second;
+            if (ks.tag_lamport == 0 && ks.tag_cid == 0) continue;
+            if (wanted[range_of(kv_pair.first)]) out.push_back({kv_pair.first, ks.tag_lamport, ks.tag_cid});
+        }
+    }
+    return out;
+}
+
+KeyState &Replica::entry(Shard &sh, const string &key) {
+    auto it = sh.kv.find(key);
+    if (it != sh.kv.end()) return it->second;
+
+    sh.data_bytes += key.size() + sizeof(KeyState);
+    return sh.kv[key];
+}
+
+void Replica::read(const string &key, int &t_int, int &t_client, Value &value) {
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.lock, server_stats);
+    KeyState &ks = entry(sh, key);
+    t_int = ks.tag_lamport;
+    t_client = ks.tag_cid;
+    value = ks.value;
+}
+
+bool Replica::own(const string &prefix, int owner) {
+    return owners.add(prefix, owner);
+}
+
+bool Replica::write(const string &key, int t_int, int t_client, Value value) {
+    int owner = owners.owner_of(key);
+    if (owner != -1 && owner != t_client) {
+        server_stats.add(Stats::OWNER_REJECTS);
+        return false;
+    }
+
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.lock, server_stats);
+    KeyState &ks = entry(sh, key);
+    bool newer = (t_int > ks.tag_lamport) || (t_int == ks.tag_lamport && t_client > ks.tag_cid);
+    if (newer) {
+        sh.data_bytes += (long long)value_size(value) - (long long)value_size(ks.value);
+        toggle_digest(key, ks);
+        ks.tag_lamport = t_int;
+        ks.tag_cid = t_client;
+        // the replaced buffer is released with the parameter, after the
+        // lock, unless a read still holds it
+        ks.value.swap(value);
+        toggle_digest(key, ks);
+    }
+    return true;
+}
+
+string Replica::stats_line() {
+    size_t keys = 0;
+    long long bytes = 0;
+    for (Shard &sh : shards) {
+        Stats::TimedLock guard(sh.lock, server_stats);
+        keys += sh.kv.size();
+        bytes += sh.data_bytes;
+    }
+
+    ostringstream oss;
+    oss << "keys=" << keys << " mem_bytes=" << bytes
+        << " partitions=" << shards.size()
+        << " owned_prefixes=" << owners.size()
+        << " owner_rejects=" << server_stats.total(Stats::OWNER_REJECTS)
+        << " sync_rounds=" << server_stats.total(Stats::SYNC_ROUNDS)
+        << " sync_ranges_repaired=" << server_stats.total(Stats::SYNC_RANGES_REPAIRED)
+        << " sync_keys_pushed=" << server_stats.total(Stats::SYNC_KEYS_PUSHED)
+        << " sync_keys_pulled=" << server_stats.total(Stats::SYNC_KEYS_PULLED);
+    return server_stats.render(oss.str());
+}
+
+Reply Replica::handle_request(const string &msg) {
+    auto t0 = chrono::steady_clock::now();
+    Reply reply = dispatch(msg);
+    auto t1 = chrono::steady_clock::now();
+
+    server_stats.record(Stats::classify(msg), chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+    return reply;
+}
+
+Reply Replica::dispatch(const string &msg) {
+    string cmd = msg.substr(0, msg.find(' '));
+
+    if (cmd == "WRITE_REQ") {
+        // the value is copied out of the line once, outside any lock
+        string key, val;
+        int ti, tc;
+        if (!Protocol::parse_write_req(msg, key, ti, tc, val)) return "ERR\n";
+
+        return write(key, ti, tc, make_value(move(val))) ? "ACK\n" : "WRITE_DENIED\n";
+    }
+
+    istringstream iss(msg);
+    iss >> cmd;
+
+    if (cmd == "READ_REQ") {
+        string key;
+        iss >> key;
+
+        int ti, tc;
+        Value val;
+        read(key, ti, tc, val);
+        return Protocol::read_resp(ti, tc, val);
+    }
+
+    if (cmd == "OWN") {
+        string prefix;
+        int owner;
+        if (!(iss >> prefix >> owner)) return "ERR\n";
+        return own(prefix, owner) ? "ACK\n" : "OWN_DENIED\n";
+    }
+
+    if (cmd == "SYNC") {
+        uint64_t root;
+        if (!(iss >> root)) return "ERR\n";
+        if (root == root_digest()) return "SAME\n";
+
+        ostringstream oss;
+        oss << "RANGES";
+        for (uint64_t d : range_digests()) oss << " " << d;
+        oss << "\n";
+        return oss.str();
+    }
+
+    if (cmd == "RANGE") {
+        vector<int> ranges;
+        int r;
+        while (iss >> r) ranges.push_back(r);
+
+        ostringstream oss;
+        oss << "KEYS";
+        for (auto &e : range_entries(ranges)) oss << " " << e.key << " " << e.t_int << " " << e.t_client;
+        oss << "\n";
+        return oss.str();
+    }
+
+    if (cmd == "STATS") {
+        return "STATS " + stats_line() + "\n";
+    }
+
+    if (cmd == "PING") {
+        return "PONG\n";
+    }
+
+    return "ERR\n";
+}
+
+void handle_client(Replica &replica, int sock) {
+    Stats::ServerStats &stats = replica.stats();
+    stats.add(Stats::CONNECTIONS);
+    stats.add(Stats::THREADS);
+
+    string msg = Network::recv_line(sock);
+    if (!msg.empty()) {
+        Network::send_reply(sock, replica.handle_request(msg));
+    }
+    close(sock);
+
+    stats.add(Stats::CONNECTIONS, -1);
+    stats.add(Stats::THREADS, -1);
+}
+
+}
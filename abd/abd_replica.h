@@ -0,0 +1,84 @@
+#pragma once
+#include "../common/types.h"
+#include "../common/stats.h"
+#include "../common/ownership.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ABD {
+    // State machine of a single ABD replica
+    class Replica {
+    public:
+        // Keys hash into SYNC_RANGES ranges for anti-entropy. Each range
+        // keeps the XOR of its (key, tag) hashes, updated on every write, so
+        // replicas holding the same tags have the same range digests.
+        static constexpr int SYNC_RANGES = 64;
+
+        struct TagEntry {
+            std::string key;
+            int t_int;
+            int t_client;
+        };
+
+        // The store is split into partitions, each with its own lock. Keys
+        // are spread by their sync range, so one lock guards a range digest.
+        explicit Replica(int partitions = 1);
+
+        // Values are shared, never copied: the lock is held only to take
+        // or swap the pointer
+        void read(const std::string &key, int &t_int, int &t_client, Value &value);
+        // Returns false, leaving the key alone, if the key has an owner
+        // other than the tag's writer t_client
+        bool write(const std::string &key, int t_int, int t_client, Value value);
+        bool write(const std::string &key, int t_int, int t_client, const std::string &value) {
+            return write(key, t_int, t_client, make_value(value));
+        }
+
+        // Make owner the only writer of keys starting with prefix. Fails if
+        // the prefix already has a different owner. Declare ownership before
+        // the prefix is first written.
+        bool own(const std::string &prefix, int owner);
+
+        static int range_of(const std::string &key);
+        // Digest over all ranges; equal roots mean nothing to reconcile
+        uint64_t root_digest();
+        std::vector<uint64_t> range_digests();
+        // Keys of the given ranges that have been written, with their tags
+        std::vector<TagEntry> range_entries(const std::vector<int> &ranges);
+
+        // Execute one request line and return the reply line
+        Reply handle_request(const std::string &msg);
+
+        // Body of the STATS reply
+        std::string stats_line();
+        Stats::ServerStats &stats() { return server_stats; }
+
+    private:
+        struct alignas(64) Shard {
+            std::mutex lock;
+            std::unordered_map<std::string, KeyState> kv;
+            long long data_bytes = 0;   // keys, values and entries; guarded by lock
+        };
+
+        Reply dispatch(const std::string &msg);
+        Shard &shard_of(const std::string &key) { return shards[range_of(key) % shards.size()]; }
+        // Look up or create a key; caller holds sh.lock
+        KeyState &entry(Shard &sh, const std::string &key);
+        // Toggle key's current tag in its range digest; caller holds its shard's lock
+        void toggle_digest(const std::string &key, const KeyState &ks);
+
+        std::vector<Shard> shards;
+        // range r is guarded by shards[r % shards.size()].lock
+        uint64_t digests[SYNC_RANGES] = {};
+
+        Ownership::Table owners;
+
+        Stats::ServerStats server_stats;
+    };
+
+    // Serve one request on an accepted socket, then close it
+    void handle_client(Replica &replica, int sock);
+}
@@ -1,122 +1,73 @@
-#include "../common/types.h"
+#include "abd_replica.h"
+#include "anti_entropy.h"
 #include "../common/network.h"
+#include "../common/server.h"
 #include <iostream>
-#include <thread>
-#include <mutex>
-#include <unordered_map>
 #include <sstream>
-#include <unistd.h>
-#include <arpa/inet.h>
+#include <functional>
 
 using namespace std;
 
-mutex store_lock;
-unordered_map<string, KeyState> kv;
-
-void handle_client(int sock) {
-    string msg = Network::recv_line(sock);
-    if (msg.empty()) {
-        close(sock);
-        return;
-    }
-
-    istringstream iss(msg);
-    string cmd;
-    iss >> cmd;
-
-    if (cmd == "READ_REQ") {
-        string key;
-        iss >> key;
-
-        int ti, tc;
-        string val;
-        {
-            lock_guard<mutex> guard(store_lock);
-            KeyState &ks = kv[key];
-            ti = ks.tag_lamport;
-            tc = ks.tag_cid;
-            val = ks.value;
-        }
-
-        ostringstream resp;
-        resp << "READ_RESP " << ti << " " << tc << " " << val << "\n";
-        Network::send_message(sock, resp.str());
-        close(sock);
-        return;
-    }
-
-    if (cmd == "WRITE_REQ") {
-        string key;
-        int ti, tc;
-        string val;
-
-        iss >> key >> ti >> tc;
-        iss >> ws;
-        getline(iss, val);
-
-        {
-            lock_guard<mutex> guard(store_lock);
-            KeyState &ks = kv[key];
-            bool newer = (ti > ks.tag_lamport) || (ti == ks.tag_lamport && tc > ks.tag_cid);
-            if(newer) {
-                ks.tag_lamport = ti;
-                ks.tag_cid = tc;
-                ks.value = val;
-            }
-        }
-
-        Network::send_message(sock, "ACK\n");
-        close(sock);
-        return;
-    }
-
-    Network::send_message(sock, "ERR\n");
-    close(sock);
-}
-
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        cout<<"Usage: ./abd_server <port>\n";
+    if (argc < 2 || argc % 2 != 0) {
+        cout << "Usage: ./abd_server <port> [--stats-interval <sec>] [--owner <prefix>:<client_id>]...\n"
+             << "       [--peers <host:port>,...] [--anti-entropy-ms <ms>]\n"
+             << "       [--backlog <n>] [--acceptors <n>] [--engine threads|epoll|io_uring]\n";
         return 1;
     }
 
     int port = stoi(argv[1]);
-
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = INADDR_ANY;
-
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt(SO_REUSEADDR)");
-        exit(1);
+    int stats_interval = 0;
+    int anti_entropy_ms = 0;
+    vector<ServerInfo> peers;
+    vector<string> owners;
+    Server::Options server_opts;
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string val = argv[i + 1];
+        if (flag == "--stats-interval") {
+            stats_interval = stoi(val);
+        } else if (flag == "--owner") {
+            owners.push_back(val);
+        } else if (flag == "--peers") {
+            istringstream list(val);
+            string spec;
+            while (getline(list, spec, ',')) peers.push_back(Network::parse_server(spec));
+        } else if (flag == "--anti-entropy-ms") {
+            anti_entropy_ms = stoi(val);
+        } else if (!Server::parse_option(flag, val, server_opts)) {
+            cout << "Unknown option or bad value: " << flag << " " << val << "\n";
+            return 1;
+        }
     }
 
-    if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(server_fd);
-        exit(1);
-    }
+    // one store partition per acceptor
+    ABD::Replica replica(server_opts.acceptors);
 
-    if (listen(server_fd, 50) < 0) {
-        perror("listen");
-        close(server_fd);
-        exit(1);
+    for (auto &spec : owners) {
+        // keys starting with <prefix> may only be written by <client_id>
+        auto pos = spec.rfind(':');
+        if (pos == string::npos || pos == 0 || !replica.own(spec.substr(0, pos), stoi(spec.substr(pos + 1)))) {
+            cout << "Invalid owner " << spec << "\n";
+            return 1;
+        }
     }
 
+    Stats::start_dumper(stats_interval, [&replica]() { return replica.stats_line(); });
 
-    cout << "ABD Server Listening on port " << port << "...\n";
+    // reconcile with the other replicas in the background
+    ABD::AntiEntropy anti_entropy(replica, peers, anti_entropy_ms);
+    anti_entropy.start();
 
-    while(1) {
-        sockaddr_in client_addr{};
-        socklen_t len = sizeof(client_addr);
-        int client_sock = accept(server_fd, (sockaddr*)&client_addr, &len);
-        if (client_sock < 0) continue;
+    Server::Handler handler;
+    handler.serve = [&replica](int sock) { ABD::handle_client(replica, sock); };
+    handler.handle = [&replica](const string &msg) { return replica.handle_request(msg); };
+    handler.stats = &replica.stats();
 
-        thread(handle_client, client_sock).detach();
+    string banner = "ABD Server Listening on port " + to_string(port) + "...";
+    if (!Server::run(port, server_opts, banner, handler)) {
+        exit(1);
     }
-
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,119 @@
+#include "anti_entropy.h"
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+namespace ABD {
+
+// Keys moved in parallel per round
+static const int SYNC_PARALLELISM = 8;
+
+// One request/response exchange; "" if the peer did not answer
+static string ask(const ServerInfo &peer, const string &req) {
+    int sock = Network::connect_to_server(peer);
+    if (sock < 0) return "";
+    string resp;
+    if (Network::send_message(sock, req)) {
+        resp = Network::recv_line(sock);
+    }
+    Network::disconnect(sock);
+    return resp;
+}
+
+static bool newer(const pair<int, int> &a, const pair<int, int> &b) {
+    return a.first > b.first || (a.first == b.first && a.second > b.second);
+}
+
+AntiEntropy::AntiEntropy(Replica &replica, vector<ServerInfo> peers, int interval_ms)
+    : replica(replica), peers(move(peers)), interval_ms(interval_ms) {}
+
+AntiEntropy::~AntiEntropy() {
+    stop();
+}
+
+void AntiEntropy::start() {
+    if (peers.empty() || interval_ms <= 0 || running.exchange(true)) return;
+
+    worker = Network::spawn([this]() {
+        size_t next = 0;
+        while (running.load()) {
+            Network::sleep_for(chrono::milliseconds(interval_ms));
+            if (!running.load()) break;
+            sync_with(peers[next++ % peers.size()]);
+        }
+    });
+}
+
+void AntiEntropy::stop() {
+    if (!running.exchange(false)) return;
+    worker.join();
+}
+
+bool AntiEntropy::sync_with(const ServerInfo &peer) {
+    Stats::ServerStats &stats = replica.stats();
+
+    string resp = ask(peer, Protocol::sync_req(replica.root_digest()));
+    if (resp.empty()) return false;
+    stats.add(Stats::SYNC_ROUNDS);
+    if (resp == "SAME") return true;
+
+    // RANGES <d0> ... <d63>
+    istringstream digests(resp);
+    string word;
+    digests >> word;
+    vector<uint64_t> mine = replica.range_digests();
+    vector<int> differ;
+    uint64_t theirs;
+    for (int r = 0; r < Replica::SYNC_RANGES && digests >> theirs; r++) {
+        if (theirs != mine[r]) differ.push_back(r);
+    }
+    if (word != "RANGES" || differ.empty()) return true;
+    stats.add(Stats::SYNC_RANGES_REPAIRED, differ.size());
+
+    // KEYS <key> <t_int> <t_client> ...
+    resp = ask(peer, Protocol::range_req(differ));
+    istringstream keys(resp);
+    keys >> word;
+    if (word != "KEYS") return false;
+
+    map<string, pair<int, int>> peer_tags, local_tags;
+    string key;
+    int ti, tc;
+    while (keys >> key >> ti >> tc) peer_tags[key] = {ti, tc};
+    for (auto &e : replica.range_entries(differ)) local_tags[e.key] = {e.t_int, e.t_client};
+
+    vector<string> push, pull;
+    for (auto &kv : local_tags) {
+        auto it = peer_tags.find(kv.first);
+        if (it == peer_tags.end() || newer(kv.second, it->second)) push.push_back(kv.first);
+    }
+    for (auto &kv : peer_tags) {
+        auto it = local_tags.find(kv.first);
+        if (it == local_tags.end() || newer(kv.second, it->second)) pull.push_back(kv.first);
+    }
+
+    Network::fan_out(SYNC_PARALLELISM, [&](int k) {
+        for (size_t i = k; i < push.size(); i += SYNC_PARALLELISM) {
+            int t_int, t_client;
+            Value value;
+            replica.read(push[i], t_int, t_client, value);
+            if (ask(peer, Protocol::write_req(push[i], t_int, t_client, value ? *value : "")) == "ACK") {
+                stats.add(Stats::SYNC_KEYS_PUSHED);
+            }
+        }
+        for (size_t i = k; i < pull.size(); i += SYNC_PARALLELISM) {
+            ReadResp r;
+            if (Protocol::parse_read_resp(ask(peer, Protocol::read_req(pull[i])), r) &&
+                replica.write(pull[i], r.t_int, r.t_client, make_value(move(r.value))))
+            {
+                stats.add(Stats::SYNC_KEYS_PULLED);
+            }
+        }
+    });
+    return true;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "abd_replica.h"
+#include "../common/types.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ABD {
+    // Background reconciliation of one replica with its peers. Every
+    // interval it syncs with the next peer in turn: equal root digests end
+    // the round; otherwise only the ranges whose digests differ are listed,
+    // and keys are pushed to or pulled from the peer wherever one side has
+    // an older tag. Merging uses the normal write rule, so a round never
+    // moves a key backwards.
+    class AntiEntropy {
+    public:
+        AntiEntropy(Replica &replica, std::vector<ServerInfo> peers, int interval_ms);
+        ~AntiEntropy();
+
+        void start();
+        void stop();
+
+        // One round with peer; false if the peer could not be reached
+        bool sync_with(const ServerInfo &peer);
+
+    private:
+        Replica &replica;
+        std::vector<ServerInfo> peers;
+        int interval_ms;
+
+        std::atomic<bool> running{false};
+        std::thread worker;
+    };
+}
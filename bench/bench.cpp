@@ -0,0 +1,335 @@
+#include "../common/types.h"
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include "../abd/abd_client.h"
+#include "../abd/abd_replica.h"
+#include "../blocking/blocking_replica.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+// Every heap allocation in the process goes through here so that each
+// benchmark can report allocations/op next to ns/op.
+static atomic<long long> g_allocs{0};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t n) {
+    g_allocs.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(n ? n : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+#pragma GCC diagnostic pop
+
+// A benchmark body runs n operations and returns the nanoseconds spent on them
+typedef function<long long(long)> BenchBody;
+
+static const double MIN_TIME_NS = 2e8;
+static const long MAX_OPS = 1L << 24;
+
+template <typename F>
+static long long time_ns(F f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+}
+
+static void run_bench(const string &name, const string &filter, BenchBody body) {
+    if (!filter.empty() && name.find(filter) == string::npos) return;
+
+    body(1); // warm up
+    long n = 1;
+    long long ns = 0, allocs = 0;
+    while (true) {
+        long long a0 = g_allocs.load();
+        ns = body(n);
+        allocs = g_allocs.load() - a0;
+        if (ns >= MIN_TIME_NS || n >= MAX_OPS) break;
+        // aim a bit past the minimum time on the next round
+        long next = ns > 0 ? (long)(n * 1.2 * MIN_TIME_NS / ns) : n * 100;
+        n = min(max(next, n * 2), MAX_OPS);
+    }
+
+    cout << left << setw(44) << name << right
+         << setw(10) << n << " ops"
+         << setw(14) << fixed << setprecision(1) << (double)ns / n << " ns/op"
+         << setw(10) << setprecision(2) << (double)allocs / n << " allocs/op\n";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Connected socket pairs: in-memory (AF_UNIX socketpair) or loopback TCP
+///////////////////////////////////////////////////////////////////////////////
+
+enum class Link { SOCKETPAIR, LOOPBACK };
+
+static const char *link_name(Link l) {
+    return l == Link::SOCKETPAIR ? "socketpair" : "loopback";
+}
+
+static int loopback_listener(int &port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror("loopback listener");
+        exit(1);
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// fds[0] is the client end, fds[1] the server end
+static bool open_link(Link l, int listen_fd, int port, int fds[2]) {
+    if (l == Link::SOCKETPAIR) {
+        return socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0;
+    }
+    fds[0] = Network::connect_to_server({"127.0.0.1", port});
+    if (fds[0] < 0) return false;
+    fds[1] = accept(listen_fd, nullptr, nullptr);
+    return fds[1] >= 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+///////////////////////////////////////////////////////////////////////////////
+
+static const string SAMPLE_RESP = "READ_RESP 1042 17 v17_482913";
+
+static void bench_recv_line(Link l, int listen_fd, int port, const string &filter) {
+    run_bench(string("recv_line/") + link_name(l), filter, [=](long n) {
+        int fds[2];
+        if (!open_link(l, listen_fd, port, fds)) return 0LL;
+
+        // Fill the socket in batches that fit in its buffer, time only the reads
+        const long BATCH = 64;
+        string batch;
+        for (long i = 0; i < BATCH; i++) batch += SAMPLE_RESP + "\n";
+
+        long long ns = 0;
+        for (long done = 0; done < n; done += BATCH) {
+            long cnt = min(BATCH, n - done);
+            Network::send_message(fds[1], batch.substr(0, cnt * (SAMPLE_RESP.size() + 1)));
+            ns += time_ns([&]() {
+                for (long i = 0; i < cnt; i++) Network::recv_line(fds[0]);
+            });
+        }
+        close(fds[0]);
+        close(fds[1]);
+        return ns;
+    });
+}
+
+static void bench_handle_client(Link l, int listen_fd, int port, const string &filter) {
+    ABD::Replica abd;
+    Blocking::Replica blk;
+    abd.write("key3", 7, 2, "v2_123456");
+    blk.lock("key3", 2);
+    blk.write("key3", 7, 2, "v2_123456");
+    blk.unlock("key3", 2);
+
+    struct Case {
+        string name;
+        string req;
+        function<void(int)> serve;
+        function<void()> reset;
+    };
+    vector<Case> cases = {
+        {"abd/READ_REQ", Protocol::read_req("key3"),
+            [&](int s) { ABD::handle_client(abd, s); }, nullptr},
+        {"abd/WRITE_REQ", Protocol::write_req("key3", 7, 2, "v2_123456"),
+            [&](int s) { ABD::handle_client(abd, s); }, nullptr},
+        {"blocking/READ_REQ", Protocol::read_req("key3"),
+            [&](int s) { Blocking::handle_client(blk, s); }, nullptr},
+        // the lease is released in-process after each grant so every
+        // iteration takes the LOCK_GRANTED path
+        {"blocking/LOCK_REQ", Protocol::lock_req("key3", 2),
+            [&](int s) { Blocking::handle_client(blk, s); },
+            [&]() { blk.unlock("key3", 2); }},
+    };
+
+    for (auto &c : cases) {
+        string name = string("handle_client/") + c.name + "/" + link_name(l);
+        run_bench(name, filter, [&, l](long n) {
+            return time_ns([&]() {
+                for (long i = 0; i < n; i++) {
+                    int fds[2];
+                    if (!open_link(l, listen_fd, port, fds)) return;
+                    Network::send_message(fds[0], c.req);
+                    c.serve(fds[1]);
+                    Network::recv_line(fds[0]);
+                    close(fds[0]);
+                    if (c.reset) c.reset();
+                }
+            });
+        });
+    }
+}
+
+static void bench_dispatch(const string &filter) {
+    ABD::Replica abd;
+    Blocking::Replica blk;
+    abd.write("key3", 7, 2, "v2_123456");
+
+    string rd = Protocol::read_req("key3");
+    string wr = Protocol::write_req("key3", 7, 2, "v2_123456");
+    string lk = Protocol::lock_req("key3", 2);
+    string ul = Protocol::unlock_req("key3", 2);
+    rd.pop_back(); wr.pop_back(); lk.pop_back(); ul.pop_back();
+
+    run_bench("dispatch/abd/READ_REQ", filter, [&](long n) {
+        return time_ns([&]() { for (long i = 0; i < n; i++) abd.handle_request(rd); });
+    });
+    run_bench("dispatch/abd/WRITE_REQ", filter, [&](long n) {
+        return time_ns([&]() { for (long i = 0; i < n; i++) abd.handle_request(wr); });
+    });
+    // a 1 MB value is parsed once on write and never copied on read
+    string big(1 << 20, 'x');
+    string big_wr = Protocol::write_req("big", 7, 2, big);
+    big_wr.pop_back();
+    abd.write("big", 7, 2, big);
+    string big_rd = Protocol::read_req("big");
+    big_rd.pop_back();
+
+    run_bench("dispatch/abd/READ_REQ/1MB", filter, [&](long n) {
+        return time_ns([&]() { for (long i = 0; i < n; i++) abd.handle_request(big_rd); });
+    });
+    run_bench("dispatch/abd/WRITE_REQ/1MB", filter, [&](long n) {
+        return time_ns([&]() { for (long i = 0; i < n; i++) abd.handle_request(big_wr); });
+    });
+    run_bench("dispatch/blocking/LOCK_REQ+UNLOCK", filter, [&](long n) {
+        return time_ns([&]() {
+            for (long i = 0; i < n; i++) {
+                blk.handle_request(lk);
+                blk.handle_request(ul);
+            }
+        });
+    });
+}
+
+static void bench_store(const string &filter) {
+    const int NUM_KEYS = 10;
+    vector<string> keys;
+    for (int i = 0; i < NUM_KEYS; i++) keys.push_back("key" + to_string(i));
+
+    for (int nthreads : {1, 2, 4, 8, 16}) {
+        for (double get_frac : {0.9, 0.1}) {
+            ostringstream name;
+            name << "store/abd/T" << nthreads << "_GET" << get_frac;
+
+            // n is the total number of operations across all threads
+            run_bench(name.str(), filter, [&, nthreads, get_frac](long n) {
+                ABD::Replica replica;
+                long per_thread = max(1L, n / nthreads);
+                vector<thread> threads;
+                atomic<int> waiting{0};
+                atomic<bool> go{false};
+                for (int t = 0; t < nthreads; t++) {
+                    threads.emplace_back([&, t]() {
+                        int ti, tc;
+                        Value val;
+                        long reads = (long)(get_frac * 100);
+                        waiting++;
+                        while (!go) this_thread::yield();
+                        for (long i = 0; i < per_thread; i++) {
+                            const string &key = keys[(i + t) % NUM_KEYS];
+                            if (i % 100 < reads) replica.read(key, ti, tc, val);
+                            else replica.write(key, (int)i, t, "v_123456");
+                        }
+                    });
+                }
+                // thread creation stays out of the timed region
+                while (waiting < nthreads) this_thread::yield();
+                return time_ns([&]() {
+                    go = true;
+                    for (auto &th : threads) th.join();
+                }) * n / (per_thread * nthreads);
+            });
+        }
+    }
+}
+
+static void bench_find_highest_tag(const string &filter) {
+    for (int R : {2, 3, 5}) {
+        vector<ReadResp> resps;
+        for (int i = 0; i < R; i++) {
+            resps.push_back({100 + i % 2, i + 1, "v" + to_string(i) + "_123456", true});
+        }
+        run_bench("find_highest_tag/R" + to_string(R), filter, [&, R](long n) {
+            return time_ns([&]() {
+                for (long i = 0; i < n; i++) {
+                    int ti = -1, tc = -1;
+                    string val;
+                    ABD::find_highest_tag(resps, R, ti, tc, val);
+                }
+            });
+        });
+    }
+}
+
+static void bench_format_parse(const string &filter) {
+    run_bench("format/read_resp", filter, [](long n) {
+        Value v = make_value("v17_482913");
+        return time_ns([&]() {
+            for (long i = 0; i < n; i++) Protocol::read_resp(1042, 17, v);
+        });
+    });
+    run_bench("format/write_req", filter, [](long n) {
+        return time_ns([&]() {
+            for (long i = 0; i < n; i++) Protocol::write_req("key3", 1042, 17, "v17_482913");
+        });
+    });
+    run_bench("parse/read_resp", filter, [](long n) {
+        return time_ns([&]() {
+            ReadResp r;
+            for (long i = 0; i < n; i++) Protocol::parse_read_resp(SAMPLE_RESP, r);
+        });
+    });
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        cout << "Usage: ./bench [name_filter]\n";
+        return 1;
+    }
+    string filter = argc == 2 ? argv[1] : "";
+
+    int port;
+    int listen_fd = loopback_listener(port);
+
+    cout << "--- Microbenchmarks (" << MIN_TIME_NS / 1e6 << " ms minimum per case) ---\n";
+
+    bench_format_parse(filter);
+    bench_find_highest_tag(filter);
+    bench_dispatch(filter);
+    bench_store(filter);
+    for (Link l : {Link::SOCKETPAIR, Link::LOOPBACK}) {
+        bench_recv_line(l, listen_fd, port, filter);
+        bench_handle_client(l, listen_fd, port, filter);
+    }
+
+    close(listen_fd);
+    return 0;
+}
@@ -1,60 +1,29 @@
 #include "blocking_client.h"
 #include "../common/network.h"
-#include <thread>
-#include <mutex>
-#include <atomic>
-#include <sstream>
-#include <unistd.h>
+#include "../common/protocol.h"
+#include "../common/health.h"
+#include "../common/quorum.h"
+#include "../common/single_flight.h"
+#include "../common/trace.h"
 
 using namespace std;
 
 namespace Blocking {
 
-// Acquire locks with early stopping once R locks obtained
-static vector<int> acquire_locks(const string &key, int client_id, const vector<ServerInfo> &servers)
+// Acquire R locks, healthy replicas first. Not hedged: a duplicate cut off
+// once R were granted could still take a lease nobody releases. held gets
+// every replica that may have granted, those that timed out included, so
+// unlocking it leaves no lease behind.
+static vector<int> acquire_locks(const string &key, int client_id, const vector<ServerInfo> &servers, vector<int> &held)
 {
-    int N = servers.size();
-    int R = N / 2 + 1;
+    int R = servers.size() / 2 + 1;
 
-    vector<int> granted;
-    granted.reserve(R);
-    mutex mtx;
-    atomic<bool> stop{false};
-
-    vector<thread> threads;
-    threads.reserve(N);
-
-    for (int i = 0; i < N; i++) {
-        threads.emplace_back([&, i]() {
-            if (stop.load()) return;
-
-            int sock = Network::connect_to_server(servers[i]);
-            if (sock < 0) return;
-
-            ostringstream oss;
-            oss << "LOCK_REQ " << key << " " << client_id << "\n";
-
-            if (!Network::send_message(sock, oss.str())) {
-                close(sock);
-                return;
-            }
-
-            string resp = Network::recv_line(sock);
-            close(sock);
-
-            if (resp == "LOCK_GRANTED") {
-                lock_guard<mutex> guard(mtx);
-                if (!stop.load()) {
-                    granted.push_back(i);
-                    if ((int)granted.size() >= R) {
-                        stop.store(true);
-                    }
-                }
-            }
-        });
-    }
+    auto grants = Quorum::call(servers, Health::preferred_order(servers), R, Protocol::lock_req(key, client_id), Trace::LOCK,
+                               [](const string &line) { return line == "LOCK_GRANTED"; }, false, &held);
 
-    for (auto &t : threads) t.join();
+    vector<int> granted;
+    for (auto &g : grants) granted.push_back(g.replica);
+    held.insert(held.end(), granted.begin(), granted.end());
     return granted;
 }
 
@@ -63,46 +32,16 @@ static vector<ReadResp> read_quorum(const string &key, const vector<int> &server
 {
     int R = server_idxs.size();
     vector<ReadResp> out(R);
-    vector<thread> threads;
-    threads.reserve(R);
-
-    for (int k = 0; k < R; k++) {
-        threads.emplace_back([&, k]() {
-            int idx = server_idxs[k];
-            int sock = Network::connect_to_server(servers[idx]);
-            if (sock < 0) {
-                out[k].valid = false;
-                return;
-            }
-
-            string req = "READ_REQ " + key + "\n";
-            if (!Network::send_message(sock, req)) {
-                close(sock);
-                out[k].valid = false;
-                return;
-            }
-
-            string resp = Network::recv_line(sock);
-            close(sock);
-
-            istringstream iss(resp);
-            string pfx;
-            int t_i, t_c;
-
-            if (!(iss >> pfx >> t_i >> t_c) || pfx != "READ_RESP") {
-                out[k].valid = false;
-                return;
-            }
-
-            string value;
-            iss >> ws;
-            getline(iss, value);
-
-            out[k] = {t_i, t_c, value, true};
+
+    auto replies = Quorum::call(servers, server_idxs, R, Protocol::read_req(key), Trace::READ,
+        [](const string &line) {
+            ReadResp r;
+            return Protocol::parse_read_resp(line, r);
         });
-    }
 
-    for (auto &t : threads) t.join();
+    for (size_t k = 0; k < replies.size(); k++) {
+        Protocol::parse_read_resp(replies[k].line, out[k]);
+    }
     return out;
 }
 
@@ -110,63 +49,64 @@ static vector<ReadResp> read_quorum(const string &key, const vector<int> &server
 static bool write_quorum(const string &key, int t_int, int t_client, const string &value, const vector<int> &server_idxs, const vector<ServerInfo> &servers)
 {
     int R = server_idxs.size();
-    atomic<int> success{0};
-    vector<thread> threads;
-    threads.reserve(R);
-
-    for (int k = 0; k < R; k++) {
-        threads.emplace_back([&, k]() {
-            int idx = server_idxs[k];
-            int sock = Network::connect_to_server(servers[idx]);
-            if (sock < 0) return;
-
-            ostringstream oss;
-            oss << "WRITE_REQ " << key << " " << t_int << " "
-                << t_client << " " << value << "\n";
-
-            if (!Network::send_message(sock, oss.str())) {
-                close(sock);
-                return;
-            }
-
-            string resp = Network::recv_line(sock);
-            close(sock);
-
-            if (resp == "ACK") {
-                success.fetch_add(1);
-            }
-        });
-    }
-
-    for (auto &t : threads) t.join();
-    return success.load() >= R;
+    auto acks = Quorum::call(servers, server_idxs, R, Protocol::write_req(key, t_int, t_client, value), Trace::WRITE,
+                             [](const string &line) { return line == "ACK"; });
+    return (int)acks.size() >= R;
 }
 
 // Unlock quorum
 static void unlock_quorum(const string &key, int client_id, const vector<int> &server_idxs, const vector<ServerInfo> &servers)
 {
-    vector<thread> threads;
-    threads.reserve(server_idxs.size());
+    Quorum::call(servers, server_idxs, server_idxs.size(), Protocol::unlock_req(key, client_id), Trace::UNLOCK,
+                 [](const string &line) { return line == "ACK"; });
+}
 
-    for (int idx : server_idxs) {
-        threads.emplace_back([&, idx]() {
-            int sock = Network::connect_to_server(servers[idx]);
-            if (sock < 0) return;
+static Async::Task<vector<int>> acquire_locks_async(const string &key, int client_id, const vector<ServerInfo> &servers, vector<int> &held)
+{
+    int R = servers.size() / 2 + 1;
 
-            ostringstream oss;
-            oss << "UNLOCK " << key << " " << client_id << "\n";
+    auto grants = co_await Quorum::call_async(servers, Health::preferred_order(servers), R, Protocol::lock_req(key, client_id),
+                                              [](const string &line) { return line == "LOCK_GRANTED"; }, &held);
 
-            Network::send_message(sock, oss.str());
-            Network::recv_line(sock);
-            close(sock);
+    vector<int> granted;
+    for (auto &g : grants) granted.push_back(g.replica);
+    held.insert(held.end(), granted.begin(), granted.end());
+    co_return granted;
+}
+
+static Async::Task<vector<ReadResp>> read_quorum_async(const string &key, const vector<int> &server_idxs, const vector<ServerInfo> &servers)
+{
+    int R = server_idxs.size();
+    vector<ReadResp> out(R);
+
+    auto replies = co_await Quorum::call_async(servers, server_idxs, R, Protocol::read_req(key),
+        [](const string &line) {
+            ReadResp r;
+            return Protocol::parse_read_resp(line, r);
         });
+
+    for (size_t k = 0; k < replies.size(); k++) {
+        Protocol::parse_read_resp(replies[k].line, out[k]);
     }
+    co_return out;
+}
 
-    for (auto &t : threads) t.join();
+static Async::Task<bool> write_quorum_async(const string &key, int t_int, int t_client, const string &value, const vector<int> &server_idxs, const vector<ServerInfo> &servers)
+{
+    int R = server_idxs.size();
+    auto acks = co_await Quorum::call_async(servers, server_idxs, R, Protocol::write_req(key, t_int, t_client, value),
+                                            [](const string &line) { return line == "ACK"; });
+    co_return (int)acks.size() >= R;
+}
+
+static Async::Task<void> unlock_quorum_async(const string &key, int client_id, const vector<int> &held, const vector<ServerInfo> &servers)
+{
+    co_await Quorum::call_async(servers, held, held.size(), Protocol::unlock_req(key, client_id),
+                                [](const string &line) { return line == "ACK"; });
 }
 
 // Find highest tag
-static bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, string &best_val)
+bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, string &best_val)
 {
     int best_i = -1;
     int valid = 0;
@@ -182,56 +122,66 @@ static bool find_highest_tag(const vector<ReadResp> &resps, int R, int &best_ti,
             best_i = i;
             best_ti = resps[i].t_int;
             best_tc = resps[i].t_client;
-            best_val = resps[i].value;
         }
     }
+    // values can be large: copy only the winner
+    if (best_i != -1) best_val = resps[best_i].value;
 
     return valid >= R && best_i != -1;
 }
 
-bool get(const string &key, int client_id, const vector<ServerInfo> &servers, string &out_value)
+static bool get_once(const string &key, int client_id, const vector<ServerInfo> &servers, string &out_value)
 {
+    Trace::Op op(Trace::GET, client_id);
     int R = servers.size()/2 + 1;
 
-    auto granted = acquire_locks(key, client_id, servers);
+    vector<int> held;
+    auto granted = acquire_locks(key, client_id, servers, held);
     if ((int)granted.size() < R) {
-        unlock_quorum(key, client_id, granted, servers);
+        unlock_quorum(key, client_id, held, servers);
         return false;
     }
 
-    granted.resize(R);
     auto resps = read_quorum(key, granted, servers);
 
     int best_ti = -1, best_tc = -1;
     string best_val;
 
     if (!find_highest_tag(resps, R, best_ti, best_tc, best_val)) {
-        unlock_quorum(key, client_id, granted, servers);
+        unlock_quorum(key, client_id, held, servers);
         return false;
     }
 
-    out_value = best_val;
-    unlock_quorum(key, client_id, granted, servers);
+    out_value = move(best_val);
+    unlock_quorum(key, client_id, held, servers);
+    op.set_ok(true);
     return true;
 }
 
+bool get(const string &key, int client_id, const vector<ServerInfo> &servers, string &out_value)
+{
+    // concurrent GETs of the same key share one lock/read/unlock round
+    return SingleFlight::run("blocking/" + key, [&](string &value) { return get_once(key, client_id, servers, value); }, out_value);
+}
+
 bool put(const string &key, const string &value, int client_id, const vector<ServerInfo> &servers)
 {
+    Trace::Op op(Trace::PUT, client_id);
     int R = servers.size()/2 + 1;
 
-    auto granted = acquire_locks(key, client_id, servers);
+    vector<int> held;
+    auto granted = acquire_locks(key, client_id, servers, held);
     if ((int)granted.size() < R) {
-        unlock_quorum(key, client_id, granted, servers);
+        unlock_quorum(key, client_id, held, servers);
         return false;
     }
 
-    granted.resize(R);
     auto resps = read_quorum(key, granted, servers);
 
     int max_ti = -1, max_tc = -1;
     string dummy;
     if (!find_highest_tag(resps, R, max_ti, max_tc, dummy)) {
-        unlock_quorum(key, client_id, granted, servers);
+        unlock_quorum(key, client_id, held, servers);
         return false;
     }
 
@@ -239,8 +189,80 @@ bool put(const string &key, const string &value, int client_id, const vector<Ser
     int new_tc = client_id;
 
     bool ok = write_quorum(key, new_ti, new_tc, value, granted, servers);
-    unlock_quorum(key, client_id, granted, servers);
+    unlock_quorum(key, client_id, held, servers);
+    op.set_ok(ok);
     return ok;
 }
 
-} // namespace Blocking
\ No newline at end of file
+bool get(const string &key, int client_id, const Partition::Groups &groups, string &out_value)
+{
+    int g = groups.group_of(key);
+    Trace::GroupScope scope(g);
+    return get(key, client_id, groups.group(g), out_value);
+}
+
+bool put(const string &key, const string &value, int client_id, const Partition::Groups &groups)
+{
+    int g = groups.group_of(key);
+    Trace::GroupScope scope(g);
+    return put(key, value, client_id, groups.group(g));
+}
+
+Async::Task<bool> get_async(const string &key, int client_id, const vector<ServerInfo> &servers, string &out_value)
+{
+    int R = servers.size()/2 + 1;
+
+    vector<int> held;
+    auto granted = co_await acquire_locks_async(key, client_id, servers, held);
+    if ((int)granted.size() < R) {
+        co_await unlock_quorum_async(key, client_id, held, servers);
+        co_return false;
+    }
+
+    auto resps = co_await read_quorum_async(key, granted, servers);
+
+    int best_ti = -1, best_tc = -1;
+    string best_val;
+    bool ok = find_highest_tag(resps, R, best_ti, best_tc, best_val);
+    if (ok) out_value = move(best_val);
+
+    co_await unlock_quorum_async(key, client_id, held, servers);
+    co_return ok;
+}
+
+Async::Task<bool> put_async(const string &key, const string &value, int client_id, const vector<ServerInfo> &servers)
+{
+    int R = servers.size()/2 + 1;
+
+    vector<int> held;
+    auto granted = co_await acquire_locks_async(key, client_id, servers, held);
+    if ((int)granted.size() < R) {
+        co_await unlock_quorum_async(key, client_id, held, servers);
+        co_return false;
+    }
+
+    auto resps = co_await read_quorum_async(key, granted, servers);
+
+    int max_ti = -1, max_tc = -1;
+    string dummy;
+    if (!find_highest_tag(resps, R, max_ti, max_tc, dummy)) {
+        co_await unlock_quorum_async(key, client_id, held, servers);
+        co_return false;
+    }
+
+    bool ok = co_await write_quorum_async(key, max_ti + 1, client_id, value, granted, servers);
+    co_await unlock_quorum_async(key, client_id, held, servers);
+    co_return ok;
+}
+
+Async::Task<bool> get_async(const string &key, int client_id, const Partition::Groups &groups, string &out_value)
+{
+    return get_async(key, client_id, groups.servers_for(key), out_value);
+}
+
+Async::Task<bool> put_async(const string &key, const string &value, int client_id, const Partition::Groups &groups)
+{
+    return put_async(key, value, client_id, groups.servers_for(key));
+}
+
+} // namespace Blocking
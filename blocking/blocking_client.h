@@ -1,9 +1,26 @@
 #pragma once
 #include "../common/types.h"
+#include "../common/async.h"
+#include "../common/partition.h"
 #include <vector>
 
 namespace Blocking {
     bool get(const std::string &key, int client_id, const std::vector<ServerInfo> &servers, std::string &out_value);
     
     bool put(const std::string &key, const std::string &value, int client_id, const std::vector<ServerInfo> &servers);
-}
\ No newline at end of file
+
+    // Run on the replica group that owns key
+    bool get(const std::string &key, int client_id, const Partition::Groups &groups, std::string &out_value);
+    bool put(const std::string &key, const std::string &value, int client_id, const Partition::Groups &groups);
+
+    // The same GET and PUT as coroutines on the current Async::Loop, so one
+    // thread can run many clients. Concurrent GETs are not coalesced and
+    // phases are not traced.
+    Async::Task<bool> get_async(const std::string &key, int client_id, const std::vector<ServerInfo> &servers, std::string &out_value);
+    Async::Task<bool> put_async(const std::string &key, const std::string &value, int client_id, const std::vector<ServerInfo> &servers);
+    Async::Task<bool> get_async(const std::string &key, int client_id, const Partition::Groups &groups, std::string &out_value);
+    Async::Task<bool> put_async(const std::string &key, const std::string &value, int client_id, const Partition::Groups &groups);
+
+    // Pick the response with the highest (t_int, t_client) tag among the first R
+    bool find_highest_tag(const std::vector<ReadResp> &resps, int R, int &best_ti, int &best_tc, std::string &best_val);
+}
@@ -0,0 +1,212 @@
+#include "blocking_replica.h"
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Blocking {
+
+// Check if lock has expired
+static bool lock_expired(const KeyState &ks) {
+    return ks.locked_by != -1 &&
+           Network::now() > ks.lock_expiry;
+}
+
+Replica::Replica(int partitions) : shards(max(partitions, 1)) {}
+
+Replica::Shard &Replica::shard_of(const string &key) {
+    return shards[hash<string>()(key) % shards.size()];
+}
+
+// Look up or create a key; caller holds sh.state_lock
+KeyState &Replica::entry(Shard &sh, const string &key) {
+    auto it = sh.kv_store.find(key);
+    if (it != sh.kv_store.end()) return it->second;
+
+    sh.data_bytes += key.size() + sizeof(KeyState);
+    return sh.kv_store[key];
+}
+
+// Drop a lease whose holder never unlocked; caller holds sh.state_lock
+void Replica::expire_lease(Shard &sh, KeyState &ks) {
+    if (lock_expired(ks)) {
+        ks.locked_by = -1;
+        sh.lock_holders--;
+        server_stats.add(Stats::LEASES_EXPIRED);
+    }
+}
+
+bool Replica::lock(const string &key, int client_id) {
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.state_lock, server_stats);
+    KeyState &ks = entry(sh, key);
+
+    expire_lease(sh, ks);
+
+    if (ks.locked_by == -1) {
+        ks.locked_by = client_id;
+        ks.lock_expiry = Network::now() +
+                        chrono::seconds(Config::LOCK_LEASE_SEC);
+        sh.lock_holders++;
+        server_stats.add(Stats::LOCKS_GRANTED);
+        return true;
+    }
+    server_stats.add(Stats::LOCKS_DENIED);
+    return false;
+}
+
+void Replica::unlock(const string &key, int client_id) {
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.state_lock, server_stats);
+    KeyState &ks = entry(sh, key);
+
+    expire_lease(sh, ks);
+
+    if (ks.locked_by == client_id) {
+        ks.locked_by = -1;
+        sh.lock_holders--;
+    }
+}
+
+void Replica::read(const string &key, int &t_int, int &t_client, Value &value) {
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.state_lock, server_stats);
+    KeyState &ks = entry(sh, key);
+
+    expire_lease(sh, ks);
+
+    t_int = ks.tag_lamport;
+    t_client = ks.tag_cid;
+    value = ks.value;
+}
+
+bool Replica::write(const string &key, int t_int, int t_client, Value value) {
+    Shard &sh = shard_of(key);
+    Stats::TimedLock guard(sh.state_lock, server_stats);
+    KeyState &ks = entry(sh, key);
+
+    expire_lease(sh, ks);
+
+    // Must hold lock to write
+    if (ks.locked_by != t_client) {
+        return false;
+    }
+
+    bool newer = (t_int > ks.tag_lamport) ||
+                (t_int == ks.tag_lamport &&
+                 t_client > ks.tag_cid);
+
+    if (newer) {
+        sh.data_bytes += (long long)value_size(value) - (long long)value_size(ks.value);
+        ks.tag_lamport = t_int;
+        ks.tag_cid = t_client;
+        // the old buffer is freed with the parameter, after the lock
+        ks.value.swap(value);
+    }
+    return true;
+}
+
+string Replica::stats_line() {
+    size_t keys = 0;
+    long long bytes = 0, holders = 0;
+    for (Shard &sh : shards) {
+        Stats::TimedLock guard(sh.state_lock, server_stats);
+        keys += sh.kv_store.size();
+        bytes += sh.data_bytes;
+        holders += sh.lock_holders;
+    }
+
+    ostringstream oss;
+    oss << "keys=" << keys << " mem_bytes=" << bytes
+        << " partitions=" << shards.size()
+        << " lock_holders=" << holders
+        << " locks_granted=" << server_stats.total(Stats::LOCKS_GRANTED)
+        << " locks_denied=" << server_stats.total(Stats::LOCKS_DENIED)
+        << " leases_expired=" << server_stats.total(Stats::LEASES_EXPIRED);
+    return server_stats.render(oss.str());
+}
+
+Reply Replica::handle_request(const string &msg) {
+    auto t0 = chrono::steady_clock::now();
+    Reply reply = dispatch(msg);
+    auto t1 = chrono::steady_clock::now();
+
+    server_stats.record(Stats::classify(msg), chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+    return reply;
+}
+
+Reply Replica::dispatch(const string &msg) {
+    string cmd = msg.substr(0, msg.find(' '));
+
+    if (cmd == "WRITE_REQ") {
+        // the value is copied out of the line once, outside any lock
+        string key, new_value;
+        int new_t_int, new_t_client;
+        if (!Protocol::parse_write_req(msg, key, new_t_int, new_t_client, new_value)) return "ERR\n";
+
+        bool ok = write(key, new_t_int, new_t_client, make_value(move(new_value)));
+        return ok ? "ACK\n" : "WRITE_DENIED\n";
+    }
+
+    istringstream iss(msg);
+    iss >> cmd;
+
+    if (cmd == "LOCK_REQ") {
+        string key;
+        int client_id;
+        iss >> key >> client_id;
+
+        return lock(key, client_id) ? "LOCK_GRANTED\n" : "LOCK_DENIED\n";
+    }
+
+    if (cmd == "UNLOCK") {
+        string key;
+        int client_id;
+        iss >> key >> client_id;
+
+        unlock(key, client_id);
+        return "ACK\n";
+    }
+
+    if (cmd == "READ_REQ") {
+        string key;
+        iss >> key;
+
+        int t_int, t_client;
+        Value val;
+        read(key, t_int, t_client, val);
+        return Protocol::read_resp(t_int, t_client, val);
+    }
+
+    if (cmd == "STATS") {
+        return "STATS " + stats_line() + "\n";
+    }
+
+    if (cmd == "PING") {
+        return "PONG\n";
+    }
+
+    return "ERR\n";
+}
+
+void handle_client(Replica &replica, int client_sock) {
+    Stats::ServerStats &stats = replica.stats();
+    stats.add(Stats::CONNECTIONS);
+    stats.add(Stats::THREADS);
+
+    string msg = Network::recv_line(client_sock);
+    if (!msg.empty()) {
+        Network::send_reply(client_sock, replica.handle_request(msg));
+    }
+    close(client_sock);
+
+    stats.add(Stats::CONNECTIONS, -1);
+    stats.add(Stats::THREADS, -1);
+}
+
+} // namespace Blocking
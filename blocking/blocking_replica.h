@@ -0,0 +1,54 @@
+#pragma once
+#include "../common/types.h"
+#include "../common/stats.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Blocking {
+    // State machine of a single lock-based replica
+    class Replica {
+    public:
+        // The store is split into partitions by key hash, each with its own lock
+        explicit Replica(int partitions = 1);
+
+        bool lock(const std::string &key, int client_id);
+        void unlock(const std::string &key, int client_id);
+        // The lock is held only to take or swap the value's pointer
+        void read(const std::string &key, int &t_int, int &t_client, Value &value);
+        // Fails unless the writer holds the key's lock
+        bool write(const std::string &key, int t_int, int t_client, Value value);
+        bool write(const std::string &key, int t_int, int t_client, const std::string &value) {
+            return write(key, t_int, t_client, make_value(value));
+        }
+
+        // Execute one request line and return the reply line
+        Reply handle_request(const std::string &msg);
+
+        // Body of the STATS reply
+        std::string stats_line();
+        Stats::ServerStats &stats() { return server_stats; }
+
+    private:
+        struct alignas(64) Shard {
+            std::mutex state_lock;
+            std::unordered_map<std::string, KeyState> kv_store;
+            // guarded by state_lock
+            long long data_bytes = 0;
+            long long lock_holders = 0;
+        };
+
+        Reply dispatch(const std::string &msg);
+        Shard &shard_of(const std::string &key);
+        KeyState &entry(Shard &sh, const std::string &key);
+        void expire_lease(Shard &sh, KeyState &ks);
+
+        std::vector<Shard> shards;
+
+        Stats::ServerStats server_stats;
+    };
+
+    // Serve one request on an accepted socket, then close it
+    void handle_client(Replica &replica, int client_sock);
+}
@@ -0,0 +1,196 @@
+#include "async.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace Async {
+
+static const int MAX_EVENTS = 256;
+
+// Bytes per recv while looking for the end of a line, growing for long ones
+static const size_t RECV_CHUNK_MIN = 4096;
+static const size_t RECV_CHUNK_MAX = 256 * 1024;
+
+const uint32_t Loop::READ_EVENTS = EPOLLIN | EPOLLRDHUP;
+const uint32_t Loop::WRITE_EVENTS = EPOLLOUT;
+
+static thread_local Loop *current_loop = nullptr;
+
+// Coroutine frame of a spawned task; starts at once and frees itself
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+static Detached detach(Task<void> task, long long &live) {
+    co_await task;
+    live--;
+}
+
+Loop::Loop() : outer(current_loop) {
+    current_loop = this;
+}
+
+Loop::~Loop() {
+    if (ep >= 0) close(ep);
+    current_loop = outer;
+}
+
+Loop *Loop::current() {
+    return current_loop;
+}
+
+void Loop::spawn(Task<void> task) {
+    live++;
+    detach(move(task), live);
+}
+
+void Wait::await_suspend(coroutine_handle<> h) {
+    waiter = h;
+    loop.add(*this);
+}
+
+void Event::notify() {
+    if (waiter) loop.post(exchange(waiter, nullptr));
+}
+
+void Loop::add(Wait &w) {
+    w.timer = timers.emplace(w.deadline, &w);
+    if (w.fd < 0) return;
+
+    if (ep < 0) ep = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = w.events;
+    ev.data.ptr = &w;
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, w.fd, &ev) < 0) {
+        // reported as a timeout
+        timers.erase(w.timer);
+        post(w.waiter);
+    }
+}
+
+void Loop::run() {
+    epoll_event events[MAX_EVENTS];
+
+    // every wait is registered with a deadline, so no timers left means
+    // nothing could ever resume the tasks still alive
+    while (!ready.empty() || (live > 0 && !timers.empty())) {
+        while (!ready.empty()) {
+            coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+        if (timers.empty()) continue;
+
+        auto wait = timers.begin()->first - Clock::now();
+        int timeout_ms = max(0L, (long)chrono::ceil<chrono::milliseconds>(wait).count());
+
+        int n = 0;
+        if (ep >= 0) {
+            n = epoll_wait(ep, events, MAX_EVENTS, timeout_ms);
+            if (n < 0 && errno != EINTR) {
+                perror("epoll_wait");
+                return;
+            }
+        } else if (timeout_ms > 0) {
+            usleep(timeout_ms * 1000);
+        }
+
+        auto finish = [&](Wait *w, bool ok) {
+            if (w->fd >= 0) epoll_ctl(ep, EPOLL_CTL_DEL, w->fd, nullptr);
+            timers.erase(w->timer);
+            w->ready = ok;
+            post(w->waiter);
+        };
+        for (int i = 0; i < n; i++) finish((Wait*)events[i].data.ptr, true);
+
+        auto now = Clock::now();
+        while (!timers.empty() && timers.begin()->first <= now) finish(timers.begin()->second, false);
+    }
+}
+
+Task<int> connect(const ServerInfo &srv, int timeout_us) {
+    Loop &loop = *Loop::current();
+    auto deadline = Clock::now() + chrono::microseconds(timeout_us);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(srv.port);
+    if (inet_pton(AF_INET, srv.host.c_str(), &addr.sin_addr) <= 0) co_return -1;
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) co_return -1;
+
+    if (::connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) co_return sock;
+
+    // co_await kept out of the || chain: g++ 12 reads the wrong awaiter there
+    bool ok = errno == EINPROGRESS;
+    if (ok) ok = co_await loop.writable(sock, deadline);
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (!ok || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        close(sock);
+        co_return -1;
+    }
+    co_return sock;
+}
+
+Task<bool> send(int sock, const string &msg, int timeout_us) {
+    Loop &loop = *Loop::current();
+    auto deadline = Clock::now() + chrono::microseconds(timeout_us);
+
+    size_t sent = 0;
+    while (sent < msg.size()) {
+        ssize_t n = ::send(sock, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!co_await loop.writable(sock, deadline)) co_return false;
+        } else {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+Task<string> recv_line(int sock, int timeout_us) {
+    Loop &loop = *Loop::current();
+    auto deadline = Clock::now() + chrono::microseconds(timeout_us);
+
+    string out;
+    size_t chunk = RECV_CHUNK_MIN;
+    while (true) {
+        size_t old = out.size();
+        out.resize(old + chunk);
+        ssize_t n = recv(sock, &out[old], chunk, 0);
+
+        if (n > 0) {
+            char *nl = (char*)memchr(&out[old], '\n', n);
+            if (nl) {
+                out.resize(nl - out.data());
+                co_return out;
+            }
+            out.resize(old + n);
+            chunk = min(chunk * 2, RECV_CHUNK_MAX);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            out.resize(old);
+            if (!co_await loop.readable(sock, deadline)) co_return "";
+        } else {
+            co_return "";
+        }
+    }
+}
+
+}
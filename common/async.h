@@ -0,0 +1,205 @@
+#pragma once
+#include "types.h"
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Coroutines for clients that keep many requests in flight on one thread.
+// Each thread runs its own Loop, an epoll reactor that resumes a coroutine
+// once its socket is ready or its deadline passes. Nothing here is shared
+// between threads; a coroutine stays on the loop that started it.
+namespace Async {
+    using Clock = std::chrono::steady_clock;
+
+    template <typename T> class Task;
+
+    namespace detail {
+        // Resumes whoever awaited the task once its body has finished
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template <typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                auto next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        struct PromiseBase {
+            std::coroutine_handle<> continuation;
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        template <typename T>
+        struct Promise : PromiseBase {
+            std::optional<T> value;
+            Task<T> get_return_object();
+            void return_value(T v) { value = std::move(v); }
+            T result() { return std::move(*value); }
+        };
+
+        template <>
+        struct Promise<void> : PromiseBase {
+            Task<void> get_return_object();
+            void return_void() {}
+            void result() {}
+        };
+    }
+
+    // A coroutine that starts when awaited and is awaited exactly once.
+    // Arguments taken by reference must outlive it, which holds when the
+    // caller awaits it right away.
+    template <typename T>
+    class Task {
+    public:
+        using promise_type = detail::Promise<T>;
+        using Handle = std::coroutine_handle<promise_type>;
+
+        explicit Task(Handle h) : h(h) {}
+        Task(Task &&o) noexcept : h(std::exchange(o.h, nullptr)) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task() {
+            if (h) h.destroy();
+        }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+            h.promise().continuation = caller;
+            return h;
+        }
+        T await_resume() { return h.promise().result(); }
+
+    private:
+        Handle h;
+    };
+
+    namespace detail {
+        template <typename T>
+        Task<T> Promise<T>::get_return_object() {
+            return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Promise<void>::get_return_object() {
+            return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+    }
+
+    class Loop;
+
+    // Suspends until fd has one of events or deadline passes; true if the
+    // fd became ready. With fd -1 it only waits for the deadline.
+    class Wait {
+    public:
+        Wait(Loop &loop, int fd, uint32_t events, Clock::time_point deadline)
+            : loop(loop), fd(fd), events(events), deadline(deadline) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const noexcept { return ready; }
+
+    private:
+        friend class Loop;
+        Loop &loop;
+        int fd;
+        uint32_t events;
+        Clock::time_point deadline;
+        std::coroutine_handle<> waiter;
+        std::multimap<Clock::time_point, Wait*>::iterator timer;
+        bool ready = false;
+    };
+
+    // Lets one coroutine wait until another on the same loop notifies it
+    class Event {
+    public:
+        explicit Event(Loop &loop) : loop(loop) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { waiter = h; }
+        void await_resume() const noexcept {}
+
+        // Resume the waiter, if any, on the loop's next turn
+        void notify();
+
+    private:
+        Loop &loop;
+        std::coroutine_handle<> waiter;
+    };
+
+    // Event loop of the calling thread; a nested loop shadows the outer one
+    // until it is destroyed
+    class Loop {
+    public:
+        Loop();
+        ~Loop();
+        Loop(const Loop &) = delete;
+        Loop &operator=(const Loop &) = delete;
+
+        // The loop of this thread, or nullptr
+        static Loop *current();
+
+        // Start task now and let it finish in the background
+        void spawn(Task<void> task);
+        // Resume coroutines until every spawned task has finished
+        void run();
+
+        Wait readable(int fd, Clock::time_point deadline) { return Wait(*this, fd, READ_EVENTS, deadline); }
+        Wait writable(int fd, Clock::time_point deadline) { return Wait(*this, fd, WRITE_EVENTS, deadline); }
+        Wait sleep_until(Clock::time_point deadline) { return Wait(*this, -1, 0, deadline); }
+
+    private:
+        friend class Wait;
+        friend class Event;
+        static const uint32_t READ_EVENTS;
+        static const uint32_t WRITE_EVENTS;
+
+        void add(Wait &w);
+        void post(std::coroutine_handle<> h) { ready.push_back(h); }
+
+        Loop *outer;            // loop this one shadows on the thread, restored on exit
+        int ep = -1;            // opened by the first wait on an fd
+        long long live = 0;     // spawned tasks not yet finished
+        std::deque<std::coroutine_handle<>> ready;
+        std::multimap<Clock::time_point, Wait*> timers;
+    };
+
+    // Run task to completion on a loop of its own on this thread. Tasks
+    // that never wait on a socket finish without touching epoll.
+    template <typename T>
+    T run(Task<T> task) {
+        std::optional<T> out;
+        Loop loop;
+        loop.spawn([](Task<T> t, std::optional<T> &out) -> Task<void> { out = co_await t; }(std::move(task), out));
+        loop.run();
+        // empty if epoll failed or the task waits on an Event nobody notifies
+        if (!out) throw std::runtime_error("Async::run: event loop stopped before the task finished");
+        return std::move(*out);
+    }
+
+    inline void run(Task<void> task) {
+        Loop loop;
+        loop.spawn(std::move(task));
+        loop.run();
+    }
+
+    // Nonblocking socket calls for the current loop. timeout_us bounds each
+    // call, as SO_RCVTIMEO/SO_SNDTIMEO do for the blocking transport.
+
+    // Connected socket, or -1
+    Task<int> connect(const ServerInfo &srv, int timeout_us);
+    Task<bool> send(int sock, const std::string &msg, int timeout_us);
+    // One reply line without its '\n', or "" on timeout, error or close.
+    // Reads ahead, so anything after the line is lost: one line per
+    // connection, as the protocol has it.
+    Task<std::string> recv_line(int sock, int timeout_us);
+}
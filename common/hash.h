@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Hashing for anything that must come out the same in every process and
+// run: key placement on the partition ring, anti-entropy digests compared
+// across replicas, and the simulator's seeded randomness. std::hash makes
+// no such promise.
+namespace Hash {
+    // FNV-1a of s, continuing from h
+    inline uint64_t fnv1a(const std::string &s, uint64_t h = 14695981039346656037ULL) {
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // splitmix64 finalizer. FNV alone leaves similar keys ("key1", "key2")
+    // close together; this spreads every input bit over the result.
+    inline uint64_t mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
@@ -0,0 +1,170 @@
+#include "health.h"
+#include "network.h"
+#include "protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace Health {
+
+struct State {
+    ServerInfo srv;
+    double srtt_us = -1;        // no sample yet
+    double rttvar_us = 0;
+    int backoff = 0;            // timeouts double per consecutive failure
+    int consecutive_failures = 0;
+    bool suspect = false;
+    long long samples = 0;
+    long long failures = 0;
+};
+
+static mutex health_lock;
+static map<pair<string, int>, State> replicas;
+
+static atomic<bool> probing{false};
+static thread prober;
+
+static const int MAX_RTO_US = Config::SOCKET_TIMEOUT_SEC * 1000000;
+
+// Caller holds health_lock
+static State &state_of(const ServerInfo &srv) {
+    State &st = replicas[{srv.host, srv.port}];
+    st.srv = srv;
+    return st;
+}
+
+static int rto_of(const State &st) {
+    double rto;
+    if (st.srtt_us >= 0) {
+        rto = st.srtt_us + 4 * st.rttvar_us;
+    } else {
+        // no sample yet: borrow the most conservative estimate of its peers
+        rto = -1;
+        for (auto &kv : replicas) {
+            const State &peer = kv.second;
+            if (peer.srtt_us >= 0) rto = max(rto, peer.srtt_us + 4 * peer.rttvar_us);
+        }
+        if (rto < 0) return MAX_RTO_US;
+    }
+    rto = max(rto, (double)Config::MIN_RTO_US) * (1 << st.backoff);
+    return (int)min(rto, (double)MAX_RTO_US);
+}
+
+int timeout_us(const ServerInfo &srv) {
+    lock_guard<mutex> guard(health_lock);
+    return rto_of(state_of(srv));
+}
+
+void record_success(const ServerInfo &srv, int rtt_us) {
+    lock_guard<mutex> guard(health_lock);
+    State &st = state_of(srv);
+
+    if (st.srtt_us < 0) {
+        st.srtt_us = rtt_us;
+        st.rttvar_us = rtt_us / 2.0;
+    } else {
+        st.rttvar_us = 0.75 * st.rttvar_us + 0.25 * fabs(st.srtt_us - rtt_us);
+        st.srtt_us = 0.875 * st.srtt_us + 0.125 * rtt_us;
+    }
+    st.samples++;
+    st.backoff = 0;
+    st.consecutive_failures = 0;
+    st.suspect = false;
+}
+
+void record_failure(const ServerInfo &srv) {
+    lock_guard<mutex> guard(health_lock);
+    State &st = state_of(srv);
+
+    st.failures++;
+    st.backoff = min(st.backoff + 1, 6);
+    if (++st.consecutive_failures >= Config::SUSPECT_AFTER_FAILURES) {
+        st.suspect = true;
+    }
+}
+
+bool is_suspect(const ServerInfo &srv) {
+    lock_guard<mutex> guard(health_lock);
+    return state_of(srv).suspect;
+}
+
+double srtt_us(const ServerInfo &srv) {
+    lock_guard<mutex> guard(health_lock);
+    return state_of(srv).srtt_us;
+}
+
+vector<int> preferred_order(const vector<ServerInfo> &servers) {
+    vector<int> healthy, suspects;
+    vector<double> srtt(servers.size());
+    lock_guard<mutex> guard(health_lock);
+    for (size_t i = 0; i < servers.size(); i++) {
+        const State &st = state_of(servers[i]);
+        srtt[i] = max(st.srtt_us, 0.0);
+        if (st.suspect) suspects.push_back(i);
+        else healthy.push_back(i);
+    }
+    // fastest first, so slow replicas only serve top-ups and hedges
+    stable_sort(healthy.begin(), healthy.end(), [&](int a, int b) { return srtt[a] < srtt[b]; });
+    healthy.insert(healthy.end(), suspects.begin(), suspects.end());
+    return healthy;
+}
+
+static void ping(const ServerInfo &srv) {
+    auto t0 = Network::now();
+    int sock = Network::connect_to_server(srv, timeout_us(srv));
+    if (sock < 0) {
+        record_failure(srv);
+        return;
+    }
+
+    Network::send_message(sock, Protocol::ping_req());
+    string resp = Network::recv_line(sock);
+    Network::disconnect(sock);
+
+    if (resp == "PONG") {
+        record_success(srv, chrono::duration_cast<chrono::microseconds>(Network::now() - t0).count());
+    } else {
+        record_failure(srv);
+    }
+}
+
+void start_prober() {
+    if (probing.exchange(true)) return;
+
+    prober = Network::spawn([]() {
+        while (probing.load()) {
+            Network::sleep_for(chrono::milliseconds(Config::PROBE_INTERVAL_MS));
+
+            vector<ServerInfo> suspects;
+            {
+                lock_guard<mutex> guard(health_lock);
+                for (auto &kv : replicas) {
+                    if (kv.second.suspect) suspects.push_back(kv.second.srv);
+                }
+            }
+            for (auto &srv : suspects) ping(srv);
+        }
+    });
+}
+
+void stop_prober() {
+    if (!probing.exchange(false)) return;
+    prober.join();
+}
+
+vector<ReplicaHealth> snapshot() {
+    vector<ReplicaHealth> out;
+    lock_guard<mutex> guard(health_lock);
+    for (auto &kv : replicas) {
+        const State &st = kv.second;
+        out.push_back({st.srv, st.srtt_us, st.rttvar_us, rto_of(st), st.suspect, st.samples, st.failures});
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "types.h"
+#include <vector>
+
+// Client-side view of replica health, shared by every client in the process.
+// Each replica keeps a smoothed RTT estimate (SRTT/RTTVAR as in RFC 6298)
+// that sets its timeout. After SUSPECT_AFTER_FAILURES consecutive failures a
+// replica becomes suspect and is skipped whenever enough others are healthy;
+// the prober pings suspects until one answers again.
+namespace Health {
+    struct ReplicaHealth {
+        ServerInfo srv;
+        double srtt_us;
+        double rttvar_us;
+        int rto_us;
+        bool suspect;
+        long long samples;
+        long long failures;
+    };
+
+    // Timeout for the next exchange with srv
+    int timeout_us(const ServerInfo &srv);
+
+    void record_success(const ServerInfo &srv, int rtt_us);
+    void record_failure(const ServerInfo &srv);
+    bool is_suspect(const ServerInfo &srv);
+    // Smoothed RTT, or -1 before the first sample
+    double srtt_us(const ServerInfo &srv);
+
+    // Indices into servers: healthy replicas fastest first, then suspects
+    std::vector<int> preferred_order(const std::vector<ServerInfo> &servers);
+
+    // Background thread that pings suspects every PROBE_INTERVAL_MS
+    void start_prober();
+    void stop_prober();
+
+    std::vector<ReplicaHealth> snapshot();
+}
@@ -0,0 +1,94 @@
+#include "hedge.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace Hedge {
+
+// Percentile is taken over the last WINDOW samples and refreshed every
+// REFRESH samples, so recording stays cheap
+static const int WINDOW = 1024;
+static const int REFRESH = 64;
+static const int MIN_SAMPLES = 32;
+
+static Policy current;
+
+struct Window {
+    vector<int> samples;
+    long long recorded = 0;
+    int percentile_us = -1;
+};
+
+static mutex window_lock;
+static map<pair<string, int>, Window> windows;
+static atomic<int> cached_delay{-1};
+
+static atomic<long long> rpcs{0}, hedges{0}, wins{0}, denied{0};
+
+void configure(const Policy &p) {
+    current = p;
+}
+
+const Policy &policy() {
+    return current;
+}
+
+int delay_us() {
+    return current.enabled ? cached_delay.load(memory_order_relaxed) : -1;
+}
+
+void record_rtt(const ServerInfo &srv, int rtt_us) {
+    if (!current.enabled) return;
+
+    lock_guard<mutex> guard(window_lock);
+    Window &w = windows[{srv.host, srv.port}];
+    if ((int)w.samples.size() < WINDOW) w.samples.push_back(rtt_us);
+    else w.samples[w.recorded % WINDOW] = rtt_us;
+    w.recorded++;
+
+    if (w.recorded < MIN_SAMPLES || w.recorded % REFRESH != 0) return;
+
+    vector<int> sorted = w.samples;
+    size_t k = min(sorted.size() - 1, (size_t)(sorted.size() * current.percentile / 100));
+    nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    w.percentile_us = sorted[k];
+
+    // a phase needs several replies, so time it by the replica that is
+    // doing best rather than by a mix that includes the slow one
+    int best = -1;
+    for (auto &kv : windows) {
+        int p = kv.second.percentile_us;
+        if (p >= 0 && (best < 0 || p < best)) best = p;
+    }
+    cached_delay.store(best, memory_order_relaxed);
+}
+
+void record_rpc() {
+    rpcs.fetch_add(1, memory_order_relaxed);
+}
+
+void record_win() {
+    wins.fetch_add(1, memory_order_relaxed);
+}
+
+int acquire(int n) {
+    // the budget grows with ordinary traffic; no lock, a few hedges over
+    // the line under a race do no harm
+    long long allowed = (long long)(current.budget * rpcs.load(memory_order_relaxed));
+    long long used = hedges.load(memory_order_relaxed);
+    int granted = (int)max(0LL, min((long long)n, allowed - used));
+
+    hedges.fetch_add(granted, memory_order_relaxed);
+    denied.fetch_add(n - granted, memory_order_relaxed);
+    return granted;
+}
+
+Counters counters() {
+    return {rpcs.load(), hedges.load(), wins.load(), denied.load()};
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "types.h"
+
+// Hedging policy shared by every client in the process. A quorum phase that
+// is still short of replies after the configured percentile of recent RPC
+// latencies at the fastest replica sends duplicates to spare replicas.
+// Hedges are rationed to a fraction of the ordinary RPCs so a slow cluster
+// never sees a retry storm. Only ABD phases hedge; the blocking client
+// never does.
+namespace Hedge {
+    struct Policy {
+        bool enabled = false;
+        double percentile = 95;     // of each replica's recent round trips
+        double budget = 0.05;       // hedges allowed per ordinary RPC
+    };
+
+    struct Counters {
+        long long rpcs;             // ordinary sends, including top-ups
+        long long hedges;           // duplicate sends
+        long long wins;             // hedges whose reply made the quorum
+        long long denied;           // hedges skipped for lack of budget
+    };
+
+    // Set once at startup before any traffic
+    void configure(const Policy &p);
+    const Policy &policy();
+
+    // Microseconds after the start of a phase at which to hedge, or -1 while
+    // hedging is off or there are too few samples to pick a percentile
+    int delay_us();
+
+    void record_rtt(const ServerInfo &srv, int rtt_us);
+    void record_rpc();
+    void record_win();
+
+    // Take up to n hedges from the budget; returns how many were granted
+    int acquire(int n);
+
+    Counters counters();
+}
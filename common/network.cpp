@@ -1,19 +1,30 @@
 #include "network.h"
+#include <algorithm>
 #include <cstring>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 
+using namespace std;
+
 namespace Network {
 
-int connect_to_server(const ServerInfo &srv) {
+///////////////////////////////////////////////////////////////////////////////
+// TCP transport
+///////////////////////////////////////////////////////////////////////////////
+
+int TcpTransport::connect(const ServerInfo &srv, int timeout_us) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) return -1;
 
     struct timeval tv;
-    tv.tv_sec = Config::SOCKET_TIMEOUT_SEC;
-    tv.tv_usec = 0;
+    tv.tv_sec = timeout_us / 1000000;
+    tv.tv_usec = timeout_us % 1000000;
     setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
     setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 
@@ -22,40 +33,206 @@ int connect_to_server(const ServerInfo &srv) {
     addr.sin_port = htons(srv.port);
 
     if (inet_pton(AF_INET, srv.host.c_str(), &addr.sin_addr) <= 0) {
-        close(sock);
+        ::close(sock);
         return -1;
     }
 
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        close(sock);
+    if (::connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        ::close(sock);
         return -1;
     }
 
     return sock;
 }
 
-std::string recv_line(int sock) {
-    std::string out;
-    char c;
+// Bytes peeked per recv while looking for the end of a line; small lines
+// stay cheap and long ones grow to the larger chunk
+static const size_t RECV_CHUNK_MIN = 4096;
+static const size_t RECV_CHUNK_MAX = 256 * 1024;
+
+string TcpTransport::recv_line(int sock) {
+    // peek a chunk straight into the line, then consume only up to the
+    // '\n' so whatever follows stays queued for the next call
+    string out;
+    size_t chunk = RECV_CHUNK_MIN;
     while (true) {
-        ssize_t n = recv(sock, &c, 1, 0);
+        size_t old = out.size();
+        out.resize(old + chunk);
+        ssize_t n = recv(sock, &out[old], chunk, MSG_PEEK);
         if (n <= 0) return "";
-        if (c == '\n') break;
-        out += c;
+
+        char *nl = (char*)memchr(&out[old], '\n', n);
+        size_t take = nl ? nl - &out[old] + 1 : n;
+        if (recv(sock, &out[old], take, 0) != (ssize_t)take) return "";
+
+        if (nl) {
+            out.resize(old + take - 1);
+            return out;
+        }
+        out.resize(old + take);
+        chunk = min(chunk * 2, RECV_CHUNK_MAX);
+    }
+}
+
+bool TcpTransport::send(int sock, const string &msg) {
+    size_t sent = 0;
+    while (sent < msg.size()) {
+        ssize_t n = ::send(sock, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+void TcpTransport::close(int sock) {
+    ::close(sock);
+}
+
+void TcpTransport::abort(int sock) {
+    ::shutdown(sock, SHUT_RDWR);
+}
+
+void TcpTransport::fan_out(int n, const function<void(int)> &fn) {
+    vector<thread> threads;
+    threads.reserve(n);
+
+    for (int i = 0; i < n; i++) {
+        threads.emplace_back(fn, i);
     }
-    return out;
+    for (auto &t : threads) t.join();
+}
+
+thread TcpTransport::spawn(function<void()> fn) {
+    return thread(move(fn));
+}
+
+void TcpTransport::sleep_for(chrono::microseconds d) {
+    this_thread::sleep_for(d);
+}
+
+void TcpTransport::wait_for(Signal &s, unique_lock<mutex> &lk, chrono::microseconds d) {
+    s.cv.wait_for(lk, d);
+}
+
+void TcpTransport::notify_all(Signal &s) {
+    s.cv.notify_all();
+}
+
+chrono::steady_clock::time_point TcpTransport::now() {
+    return chrono::steady_clock::now();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Active transport
+///////////////////////////////////////////////////////////////////////////////
+
+static TcpTransport tcp_transport;
+static Transport *active = &tcp_transport;
+
+Transport &transport() {
+    return *active;
+}
+
+void set_transport(Transport *t) {
+    active = t ? t : &tcp_transport;
 }
 
-ServerInfo parse_server(const std::string &spec) {
+int connect_to_server(const ServerInfo &srv, int timeout_us) {
+    return active->connect(srv, timeout_us);
+}
+
+string recv_line(int sock) {
+    return active->recv_line(sock);
+}
+
+ServerInfo parse_server(const string &spec) {
     ServerInfo s;
     auto pos = spec.find(':');
     s.host = spec.substr(0, pos);
-    s.port = std::stoi(spec.substr(pos + 1));
+    s.port = stoi(spec.substr(pos + 1));
     return s;
 }
 
-bool send_message(int sock, const std::string &msg) {
-    return send(sock, msg.c_str(), msg.size(), 0) >= 0;
+bool send_message(int sock, const string &msg) {
+    return active->send(sock, msg);
+}
+
+int reply_iov(const Reply &r, size_t sent, iovec iov[3]) {
+    const string *pieces[3] = {&r.head, r.value.get(), &r.tail};
+    int n = 0;
+    for (const string *p : pieces) {
+        if (!p) continue;
+        if (sent >= p->size()) {
+            sent -= p->size();
+            continue;
+        }
+        iov[n].iov_base = (void*)(p->data() + sent);
+        iov[n].iov_len = p->size() - sent;
+        sent = 0;
+        n++;
+    }
+    return n;
+}
+
+bool send_reply(int sock, const Reply &r) {
+    size_t sent = 0, total = r.size();
+    while (sent < total) {
+        msghdr msg{};
+        iovec iov[3];
+        msg.msg_iov = iov;
+        msg.msg_iovlen = reply_iov(r, sent, iov);
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+void disconnect(int sock) {
+    active->close(sock);
+}
+
+void abort(int sock) {
+    active->abort(sock);
+}
+
+void fan_out(int n, const function<void(int)> &fn) {
+    active->fan_out(n, fn);
 }
 
-}
\ No newline at end of file
+thread spawn(function<void()> fn) {
+    return active->spawn(move(fn));
+}
+
+bool pin_to_core(int core) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) return false;
+
+    int want = core % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || want-- > 0) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        return pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0;
+    }
+    return false;
+}
+
+void sleep_for(chrono::microseconds d) {
+    active->sleep_for(d);
+}
+
+void wait_for(Signal &s, unique_lock<mutex> &lk, chrono::microseconds d) {
+    active->wait_for(s, lk, d);
+}
+
+void notify_all(Signal &s) {
+    active->notify_all(s);
+}
+
+chrono::steady_clock::time_point now() {
+    return active->now();
+}
+
+}
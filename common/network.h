@@ -1,10 +1,89 @@
 #pragma once
 #include "types.h"
 #include <string>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
 
 namespace Network {
-    int connect_to_server(const ServerInfo &srv);
+    // Condition variable for state guarded by the caller's mutex. Waiting
+    // goes through the transport so the simulator knows the thread is idle.
+    struct Signal {
+        std::condition_variable cv;
+        std::vector<int> waiters;   // simulator bookkeeping
+    };
+
+    // Everything the clients do on the wire goes through a Transport so the
+    // protocols can run over real sockets or inside a simulation.
+    class Transport {
+    public:
+        virtual ~Transport() = default;
+
+        // Returns a connection handle, or -1 on failure. timeout_us bounds
+        // the connect and every later send/recv on the connection.
+        virtual int connect(const ServerInfo &srv, int timeout_us) = 0;
+        virtual bool send(int conn, const std::string &msg) = 0;
+        // Returns "" on timeout, error or closed connection
+        virtual std::string recv_line(int conn) = 0;
+        virtual void close(int conn) = 0;
+        // Make a pending or later recv_line() on conn return "" right away;
+        // safe to call from another thread until conn is closed
+        virtual void abort(int conn) = 0;
+
+        // Run fn(0) .. fn(n-1) concurrently and wait for all of them
+        virtual void fan_out(int n, const std::function<void(int)> &fn) = 0;
+        // Start a long-lived background thread; the caller joins it
+        virtual std::thread spawn(std::function<void()> fn) = 0;
+        virtual void sleep_for(std::chrono::microseconds d) = 0;
+        // Release lk and wait until notify_all(s) or d elapses, then relock.
+        // May wake spuriously, so re-check the condition.
+        virtual void wait_for(Signal &s, std::unique_lock<std::mutex> &lk, std::chrono::microseconds d) = 0;
+        virtual void notify_all(Signal &s) = 0;
+        virtual std::chrono::steady_clock::time_point now() = 0;
+    };
+
+    class TcpTransport : public Transport {
+    public:
+        int connect(const ServerInfo &srv, int timeout_us) override;
+        bool send(int conn, const std::string &msg) override;
+        std::string recv_line(int conn) override;
+        void close(int conn) override;
+        void abort(int conn) override;
+        void fan_out(int n, const std::function<void(int)> &fn) override;
+        std::thread spawn(std::function<void()> fn) override;
+        void sleep_for(std::chrono::microseconds d) override;
+        void wait_for(Signal &s, std::unique_lock<std::mutex> &lk, std::chrono::microseconds d) override;
+        void notify_all(Signal &s) override;
+        std::chrono::steady_clock::time_point now() override;
+    };
+
+    constexpr int DEFAULT_TIMEOUT_US = Config::SOCKET_TIMEOUT_SEC * 1000000;
+
+    // Defaults to a TcpTransport; set once at startup before any traffic
+    Transport &transport();
+    void set_transport(Transport *t);
+
+    int connect_to_server(const ServerInfo &srv, int timeout_us = DEFAULT_TIMEOUT_US);
     std::string recv_line(int sock);
     ServerInfo parse_server(const std::string &spec);
     bool send_message(int sock, const std::string &msg);
-}
\ No newline at end of file
+    // Server side: write all of r to a blocking socket without joining it
+    bool send_reply(int sock, const Reply &r);
+    // The pieces of r left after its first sent bytes; returns how many
+    int reply_iov(const Reply &r, size_t sent, iovec iov[3]);
+    void disconnect(int sock);
+    void abort(int sock);
+    void fan_out(int n, const std::function<void(int)> &fn);
+    std::thread spawn(std::function<void()> fn);
+    // Pin the calling thread to the core-th CPU it may run on, wrapping
+    // around; false if the affinity could not be set
+    bool pin_to_core(int core);
+    void sleep_for(std::chrono::microseconds d);
+    void wait_for(Signal &s, std::unique_lock<std::mutex> &lk, std::chrono::microseconds d);
+    void notify_all(Signal &s);
+    std::chrono::steady_clock::time_point now();
+}
@@ -0,0 +1,36 @@
+#include "ownership.h"
+
+using namespace std;
+
+namespace Ownership {
+
+bool Table::add(const string &prefix, int owner) {
+    lock_guard<mutex> guard(lock);
+    auto it = owners.find(prefix);
+    if (it != owners.end()) return it->second == owner;
+    owners[prefix] = owner;
+    any.store(true);
+    return true;
+}
+
+int Table::owner_of(const string &key) const {
+    if (!any.load()) return -1;
+
+    lock_guard<mutex> guard(lock);
+    int owner = -1;
+    size_t best = 0;
+    for (auto &kv : owners) {
+        if (kv.first.size() >= best && key.compare(0, kv.first.size(), kv.first) == 0) {
+            owner = kv.second;
+            best = kv.first.size();
+        }
+    }
+    return owner;
+}
+
+size_t Table::size() const {
+    lock_guard<mutex> guard(lock);
+    return owners.size();
+}
+
+}
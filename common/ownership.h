@@ -0,0 +1,24 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Single-writer key prefixes of ABD. Clients and replicas look owners up in
+// the same kind of table, so they cannot disagree on who may write a key.
+namespace Ownership {
+    class Table {
+    public:
+        // Make owner the only writer of keys starting with prefix. Fails,
+        // leaving the table alone, if the prefix has a different owner.
+        bool add(const std::string &prefix, int owner);
+        // Owner of the longest declared prefix of key, or -1
+        int owner_of(const std::string &key) const;
+        size_t size() const;
+
+    private:
+        mutable std::mutex lock;
+        std::map<std::string, int> owners;      // prefix -> client id; guarded by lock
+        std::atomic<bool> any{false};           // lookups skip the lock until the first add
+    };
+}
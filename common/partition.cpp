@@ -0,0 +1,36 @@
+#include "partition.h"
+#include "hash.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace Partition {
+
+static uint64_t hash_of(const string &s) {
+    return Hash::mix(Hash::fnv1a(s));
+}
+
+Groups::Groups(vector<vector<ServerInfo>> groups, int vnodes) : groups(move(groups)) {
+    for (int g = 0; g < size(); g++) {
+        for (int v = 0; v < vnodes; v++) {
+            ring.push_back({hash_of("group" + to_string(g) + "#" + to_string(v)), g});
+        }
+    }
+    sort(ring.begin(), ring.end());
+}
+
+int Groups::group_of(const string &key) const {
+    if (ring.empty()) return 0;
+    auto it = lower_bound(ring.begin(), ring.end(), make_pair(hash_of(key), 0));
+    return it == ring.end() ? ring.front().second : it->second;
+}
+
+bool split(const vector<ServerInfo> &servers, int n, vector<vector<ServerInfo>> &out) {
+    if (n < 1 || servers.empty() || servers.size() % n != 0) return false;
+    size_t per = servers.size() / n;
+    out.assign(n, {});
+    for (size_t i = 0; i < servers.size(); i++) out[i / per].push_back(servers[i]);
+    return true;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "types.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Client-side partitioning of the key space across independent replica
+// groups. Each group places vnodes points on a hash ring and owns the keys
+// whose hash falls on or before one of its points, so adding a group only
+// moves about 1/G of the keys. Every group runs its own quorums.
+namespace Partition {
+    constexpr int DEFAULT_VNODES = 128;
+
+    class Groups {
+    public:
+        Groups(std::vector<std::vector<ServerInfo>> groups, int vnodes = DEFAULT_VNODES);
+
+        int size() const { return (int)groups.size(); }
+        const std::vector<ServerInfo> &group(int g) const { return groups[g]; }
+
+        int group_of(const std::string &key) const;
+        // Replicas of the group that owns key
+        const std::vector<ServerInfo> &servers_for(const std::string &key) const { return groups[group_of(key)]; }
+
+    private:
+        std::vector<std::vector<ServerInfo>> groups;
+        std::vector<std::pair<uint64_t, int>> ring;     // (point, group), sorted
+    };
+
+    // Split servers into n consecutive groups of equal size; false if they
+    // do not divide evenly
+    bool split(const std::vector<ServerInfo> &servers, int n, std::vector<std::vector<ServerInfo>> &out);
+}
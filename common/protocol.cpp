@@ -0,0 +1,111 @@
+#include "protocol.h"
+#include <sstream>
+
+using namespace std;
+
+namespace Protocol {
+
+string read_req(const string &key) {
+    return "READ_REQ " + key + "\n";
+}
+
+string write_req(const string &key, int t_int, int t_client, const string &value) {
+    // values can be megabytes: build the line with a single copy of it
+    string head = "WRITE_REQ " + key + " " + to_string(t_int) + " " + to_string(t_client) + " ";
+    string out;
+    out.reserve(head.size() + value.size() + 1);
+    out += head;
+    out += value;
+    out += '\n';
+    return out;
+}
+
+string lock_req(const string &key, int client_id) {
+    ostringstream oss;
+    oss << "LOCK_REQ " << key << " " << client_id << "\n";
+    return oss.str();
+}
+
+string unlock_req(const string &key, int client_id) {
+    ostringstream oss;
+    oss << "UNLOCK " << key << " " << client_id << "\n";
+    return oss.str();
+}
+
+string stats_req() {
+    return "STATS\n";
+}
+
+string ping_req() {
+    return "PING\n";
+}
+
+string own_req(const string &prefix, int client_id) {
+    ostringstream oss;
+    oss << "OWN " << prefix << " " << client_id << "\n";
+    return oss.str();
+}
+
+string sync_req(uint64_t root) {
+    ostringstream oss;
+    oss << "SYNC " << root << "\n";
+    return oss.str();
+}
+
+string range_req(const vector<int> &ranges) {
+    ostringstream oss;
+    oss << "RANGE";
+    for (int r : ranges) oss << " " << r;
+    oss << "\n";
+    return oss.str();
+}
+
+Reply read_resp(int t_int, int t_client, const Value &value) {
+    Reply r("READ_RESP " + to_string(t_int) + " " + to_string(t_client) + " ");
+    r.value = value;
+    r.tail = "\n";
+    return r;
+}
+
+// Offset of the value that follows n space-separated fields, or npos. Only
+// the fields go through a stream; the value is copied out once.
+static size_t value_offset(const string &line, int n) {
+    size_t pos = 0;
+    for (int f = 0; f < n; f++) {
+        pos = line.find_first_not_of(' ', pos);
+        if (pos == string::npos) return pos;
+        pos = line.find(' ', pos);
+        if (pos == string::npos) return pos;
+    }
+    return line.find_first_not_of(' ', pos);
+}
+
+bool parse_read_resp(const string &line, ReadResp &out) {
+    size_t at = value_offset(line, 3);
+    istringstream iss(line.substr(0, at));
+    string pfx;
+    int t_i, t_c;
+
+    if (!(iss >> pfx >> t_i >> t_c) || pfx != "READ_RESP") {
+        out.valid = false;
+        return false;
+    }
+
+    out.t_int = t_i;
+    out.t_client = t_c;
+    out.value = at == string::npos ? "" : line.substr(at);
+    out.valid = true;
+    return true;
+}
+
+bool parse_write_req(const string &line, string &key, int &t_int, int &t_client, string &value) {
+    size_t at = value_offset(line, 4);
+    istringstream iss(line.substr(0, at));
+    string cmd;
+
+    if (!(iss >> cmd >> key >> t_int >> t_client) || cmd != "WRITE_REQ") return false;
+    value = at == string::npos ? "" : line.substr(at);
+    return true;
+}
+
+}
\ No newline at end of file
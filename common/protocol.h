@@ -0,0 +1,30 @@
+#pragma once
+#include "types.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Wire format shared by clients and servers. Every message is a single
+// '\n'-terminated line.
+namespace Protocol {
+    std::string read_req(const std::string &key);
+    std::string write_req(const std::string &key, int t_int, int t_client, const std::string &value);
+    std::string lock_req(const std::string &key, int client_id);
+    std::string unlock_req(const std::string &key, int client_id);
+    std::string stats_req();
+    std::string ping_req();
+    // Declare client_id the only writer of keys starting with prefix (ABD)
+    std::string own_req(const std::string &prefix, int client_id);
+    // Anti-entropy between ABD replicas: compare root digests, then list
+    // the (key, tag) pairs of the ranges that differ
+    std::string sync_req(uint64_t root);
+    std::string range_req(const std::vector<int> &ranges);
+
+    // The value is sent from the stored buffer, not copied into the line
+    Reply read_resp(int t_int, int t_client, const Value &value);
+
+    // Parse "READ_RESP <t_int> <t_client> <value>" (no trailing newline)
+    bool parse_read_resp(const std::string &line, ReadResp &out);
+    // Parse "WRITE_REQ <key> <t_int> <t_client> <value>" (no trailing newline)
+    bool parse_write_req(const std::string &line, std::string &key, int &t_int, int &t_client, std::string &value);
+}
@@ -0,0 +1,277 @@
+#include "quorum.h"
+#include "network.h"
+#include "health.h"
+#include "hedge.h"
+#include <algorithm>
+#include <mutex>
+#include <unistd.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace Quorum {
+
+// Shared by the workers of one call(); lets the worker that completes the
+// quorum cut the remaining exchanges short
+struct Inflight {
+    mutex m;
+    Network::Signal changed;
+    bool done = false;
+    vector<int> socks;          // per slot, -1 when not in recv
+};
+
+// Returns "" on no answer, or when call() gave up on the exchange; sent
+// tells whether req may have reached the replica all the same
+static string exchange(const ServerInfo &srv, const string &req, Trace::RpcTimer &rpc,
+                       Inflight *inflight, int slot, bool &sent)
+{
+    bool aborted = false;
+    auto t0 = Network::now();
+    int sock = Network::connect_to_server(srv, Health::timeout_us(srv));
+    if (sock < 0) {
+        Health::record_failure(srv);
+        return "";
+    }
+    rpc.connected();
+
+    if (inflight) {
+        lock_guard<mutex> guard(inflight->m);
+        if (inflight->done) {
+            Network::disconnect(sock);
+            return "";
+        }
+        inflight->socks[slot] = sock;
+    }
+
+    sent = true;
+    string resp;
+    if (Network::send_message(sock, req)) {
+        resp = Network::recv_line(sock);
+    }
+
+    if (inflight) {
+        // after this call() can no longer abort the socket, so it is safe to close
+        lock_guard<mutex> guard(inflight->m);
+        inflight->socks[slot] = -1;
+        aborted = inflight->done && resp.empty();
+    }
+    Network::disconnect(sock);
+
+    if (aborted) return "";
+    if (resp.empty()) {
+        Health::record_failure(srv);
+    } else {
+        int rtt_us = chrono::duration_cast<chrono::microseconds>(Network::now() - t0).count();
+        Health::record_success(srv, rtt_us);
+        Hedge::record_rtt(srv, rtt_us);
+    }
+    return resp;
+}
+
+string rpc(const ServerInfo &srv, const string &req, Trace::RpcTimer &rpc) {
+    bool sent = false;
+    return exchange(srv, req, rpc, nullptr, 0, sent);
+}
+
+vector<Reply> call(const vector<ServerInfo> &servers, const vector<int> &order, int need,
+                   const string &req, Trace::Phase phase,
+                   const function<bool(const string&)> &accept,
+                   bool hedge, vector<int> *silent)
+{
+    int n = order.size();
+    Trace::PhaseScope scope(phase, n);
+
+    Inflight inflight;
+    inflight.socks.assign(n, -1);
+    inflight.done = need <= 0;
+
+    // slots below launched may send; hedges are the slots in [hedge_from, hedge_to)
+    int launched = min(need, n);
+    int hedge_from = -1, hedge_to = -1;
+    bool hedged = false;
+    int hedge_us = hedge ? Hedge::delay_us() : -1;
+    auto start = Network::now();
+
+    vector<pair<int, Reply>> accepted;     // (slot, reply)
+
+    Network::fan_out(n, [&](int k) {
+        unique_lock<mutex> lk(inflight.m);
+
+        // spares wait for a failed slot to replace or for the hedge timer
+        while (!inflight.done && k >= launched) {
+            if (hedge_us >= 0 && !hedged) {
+                auto elapsed = chrono::duration_cast<chrono::microseconds>(Network::now() - start).count();
+                if (elapsed < hedge_us) {
+                    Network::wait_for(inflight.changed, lk, chrono::microseconds(hedge_us - elapsed));
+                    continue;
+                }
+                // duplicate every reply still missing, as far as spares and
+                // budget go. Spares are ordered fastest first; one that is
+                // usually much slower than the delay is left alone.
+                hedged = true;
+                int spares = 0;
+                while (launched + spares < n && Health::srtt_us(servers[order[launched + spares]]) <= 2.0 * hedge_us) spares++;
+                int missing = need - (int)accepted.size();
+                int h = Hedge::acquire(min(missing, spares));
+                hedge_from = launched;
+                hedge_to = launched + h;
+                launched += h;
+                Network::notify_all(inflight.changed);
+            } else {
+                Network::wait_for(inflight.changed, lk, chrono::microseconds(Network::DEFAULT_TIMEOUT_US));
+            }
+        }
+        if (inflight.done) return;
+        bool is_hedge = k >= hedge_from && k < hedge_to;
+        lk.unlock();
+
+        if (!is_hedge) Hedge::record_rpc();
+
+        int idx = order[k];
+        Trace::RpcTimer timer(scope.get(), k, idx);
+        bool sent = false;
+        string resp = exchange(servers[idx], req, timer, &inflight, k, sent);
+        bool ok = !resp.empty() && accept(resp);
+        timer.done(ok);
+
+        lk.lock();
+        if (silent && sent && resp.empty()) silent->push_back(idx);
+        if (inflight.done) return;
+        if (ok) {
+            accepted.push_back({k, {idx, move(resp)}});
+            if (is_hedge) Hedge::record_win();
+            if ((int)accepted.size() >= need) {
+                // quorum reached: stop stragglers and idle spares
+                inflight.done = true;
+                for (int s : inflight.socks) {
+                    if (s >= 0) Network::abort(s);
+                }
+            }
+        } else if (launched < n) {
+            launched++;
+        }
+        Network::notify_all(inflight.changed);
+    });
+
+    sort(accepted.begin(), accepted.end(), [](const pair<int, Reply> &a, const pair<int, Reply> &b) {
+        return a.first < b.first;
+    });
+    vector<Reply> out;
+    out.reserve(accepted.size());
+    for (auto &a : accepted) out.push_back(move(a.second));
+    return out;
+}
+
+// State of one call_async(), kept in its frame; the call returns only
+// after all of its exchanges have
+struct AsyncCall {
+    const vector<ServerInfo> &servers;
+    const vector<int> &order;
+    const string &req;
+    const function<bool(const string&)> &accept;
+    vector<int> *silent;
+
+    int need;
+    int launched;           // slots below launched have been started
+    int running = 0;
+    bool done;
+    vector<int> socks;      // per slot, -1 when not connected
+    vector<pair<int, Reply>> accepted;
+    Async::Event changed;
+};
+
+static Async::Task<string> exchange_async(const ServerInfo &srv, AsyncCall &c, int slot, bool &sent)
+{
+    bool aborted = false;
+    auto t0 = Network::now();
+    int timeout_us = Health::timeout_us(srv);
+    int sock = co_await Async::connect(srv, timeout_us);
+    if (sock < 0) {
+        Health::record_failure(srv);
+        co_return "";
+    }
+    if (c.done) {
+        close(sock);
+        co_return "";
+    }
+
+    c.socks[slot] = sock;
+    sent = true;
+    string resp;
+    if (co_await Async::send(sock, c.req, timeout_us)) {
+        resp = co_await Async::recv_line(sock, timeout_us);
+    }
+    c.socks[slot] = -1;
+    aborted = c.done && resp.empty();
+    close(sock);
+
+    if (aborted) co_return "";
+    if (resp.empty()) {
+        Health::record_failure(srv);
+    } else {
+        int rtt_us = chrono::duration_cast<chrono::microseconds>(Network::now() - t0).count();
+        Health::record_success(srv, rtt_us);
+        Hedge::record_rtt(srv, rtt_us);
+    }
+    co_return resp;
+}
+
+static void start_slot(AsyncCall &c, int k);
+
+static Async::Task<void> run_slot(AsyncCall &c, int k)
+{
+    int idx = c.order[k];
+    bool sent = false;
+    string resp = co_await exchange_async(c.servers[idx], c, k, sent);
+    bool ok = !resp.empty() && c.accept(resp);
+    if (c.silent && sent && resp.empty()) c.silent->push_back(idx);
+
+    if (c.done) {
+        // the quorum is complete without this reply
+    } else if (ok) {
+        c.accepted.push_back({k, {idx, move(resp)}});
+        if ((int)c.accepted.size() >= c.need) {
+            // quorum reached: wake the stragglers, which then give up
+            c.done = true;
+            for (int s : c.socks) {
+                if (s >= 0) shutdown(s, SHUT_RDWR);
+            }
+        }
+    } else if (c.launched < (int)c.order.size()) {
+        start_slot(c, c.launched++);
+    }
+
+    c.running--;
+    c.changed.notify();
+}
+
+static void start_slot(AsyncCall &c, int k)
+{
+    c.running++;
+    Async::Loop::current()->spawn(run_slot(c, k));
+}
+
+Async::Task<vector<Reply>> call_async(const vector<ServerInfo> &servers, const vector<int> &order, int need,
+                                      const string &req,
+                                      const function<bool(const string&)> &accept,
+                                      vector<int> *silent)
+{
+    int n = order.size();
+    AsyncCall c{servers, order, req, accept, silent, need, min(need, n), 0, need <= 0,
+                vector<int>(n, -1), {}, Async::Event(*Async::Loop::current())};
+
+    // a slot that fails at once starts the next one itself
+    int first = c.launched;
+    for (int k = 0; k < first; k++) start_slot(c, k);
+    while (c.running > 0) co_await c.changed;
+
+    sort(c.accepted.begin(), c.accepted.end(), [](const pair<int, Reply> &a, const pair<int, Reply> &b) {
+        return a.first < b.first;
+    });
+    vector<Reply> out;
+    out.reserve(c.accepted.size());
+    for (auto &a : c.accepted) out.push_back(move(a.second));
+    co_return out;
+}
+
+}
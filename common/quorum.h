@@ -0,0 +1,46 @@
+#pragma once
+#include "types.h"
+#include "async.h"
+#include "trace.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Quorum {
+    struct Reply {
+        int replica;        // index into servers
+        std::string line;
+    };
+
+    // One request/response exchange on a fresh connection, bounded by the
+    // replica's adaptive timeout. Feeds the replica's health and marks the
+    // connect in rpc; the caller marks rpc done. Returns "" on no answer.
+    std::string rpc(const ServerInfo &srv, const std::string &req, Trace::RpcTimer &rpc);
+
+    // Send req to the first `need` replicas of order, replacing any that fail
+    // or whose reply accept() rejects with the next ones, until `need`
+    // replies are accepted or the candidates run out. When hedge is true,
+    // hedging is on and the phase is still short after Hedge::delay_us(),
+    // the missing replies are also requested from spare replicas. Exchanges
+    // still in flight once the quorum is complete are aborted. Returns the
+    // accepted replies in the order their replicas appear in order.
+    // The blocking client never hedges: its lock phase passes hedge false,
+    // and its later phases ask exactly the replicas it locked, so there are
+    // no spares. With hedge false only failed exchanges are replaced. A
+    // request that timed out may still take effect on its replica, so a
+    // caller that has to undo it, as the blocking client does with its
+    // locks, passes silent to collect the replicas that were sent req but
+    // never answered.
+    std::vector<Reply> call(const std::vector<ServerInfo> &servers, const std::vector<int> &order, int need,
+                            const std::string &req, Trace::Phase phase,
+                            const std::function<bool(const std::string&)> &accept,
+                            bool hedge = true, std::vector<int> *silent = nullptr);
+
+    // call() for coroutines: the exchanges run side by side on the current
+    // Async::Loop instead of on threads of their own. Same replacement and
+    // abort rules and silent list, but no hedging and no tracing.
+    Async::Task<std::vector<Reply>> call_async(const std::vector<ServerInfo> &servers, const std::vector<int> &order, int need,
+                                               const std::string &req,
+                                               const std::function<bool(const std::string&)> &accept,
+                                               std::vector<int> *silent = nullptr);
+}
@@ -0,0 +1,167 @@
+#include "server.h"
+#include "network.h"
+#include "types.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+using namespace std;
+
+namespace Server {
+
+// Whole non-negative number in val, or -1
+static int count_of(const string &val) {
+    try {
+        size_t end;
+        int n = stoi(val, &end);
+        return end == val.size() && n >= 0 ? n : -1;
+    } catch (...) {
+        return -1;
+    }
+}
+
+bool parse_option(const string &flag, const string &val, Options &opts) {
+    if (flag == "--backlog") {
+        opts.backlog = count_of(val);
+        if (opts.backlog < 0) return false;
+    } else if (flag == "--acceptors") {
+        opts.acceptors = count_of(val);
+        if (opts.acceptors < 0) return false;
+    } else if (flag == "--engine") {
+        if (val == "threads") opts.engine = THREADS;
+        else if (val == "epoll") opts.engine = EPOLL;
+        else if (val == "io_uring") opts.engine = IO_URING;
+        else return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char *engine_name(Engine e) {
+    return e == EPOLL ? "epoll" : e == IO_URING ? "io_uring" : "threads";
+}
+
+static int listen_on(int port, int backlog, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEADDR)");
+        close(fd);
+        return -1;
+    }
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, backlog) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Accept and serve on fd with the given engine; returns only if the
+// engine fails
+static bool serve_on(int fd, Engine engine, const Handler &handler, bool inline_serve) {
+    if (engine == EPOLL) return serve_epoll(fd, handler);
+    if (engine == IO_URING) return serve_uring(fd, handler);
+
+    // a worker serves one connection at a time, so a client that never
+    // sends, or never reads its reply, must not hold it for longer than a
+    // client timeout
+    timeval tv{Config::SOCKET_TIMEOUT_SEC, 0};
+    while (true) {
+        int sock = accept(fd, nullptr, nullptr);
+        if (sock < 0) continue;
+        if (inline_serve) {
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            handler.serve(sock);
+        } else {
+            thread(handler.serve, sock).detach();
+        }
+    }
+}
+
+bool run(int port, const Options &opts, const string &banner, const Handler &handler) {
+    Engine engine = opts.engine;
+    if (engine == IO_URING && !uring_supported()) {
+        cerr << "io_uring not supported by this kernel, using epoll\n";
+        engine = EPOLL;
+    }
+
+    // open every listener up front so a bind failure is reported at startup
+    int workers = max(opts.acceptors, 1);
+    vector<int> fds;
+    for (int i = 0; i < workers; i++) {
+        int fd = listen_on(port, opts.backlog, opts.acceptors > 0);
+        if (fd < 0) {
+            for (int f : fds) close(f);
+            return false;
+        }
+        if (engine != THREADS) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fds.push_back(fd);
+    }
+
+    cout << banner;
+    if (engine != THREADS || opts.acceptors > 0) {
+        cout << " (" << engine_name(engine) << ", " << workers << (workers == 1 ? " worker" : " workers") << ")";
+    }
+    cout << "\n" << flush;
+
+    if (opts.acceptors <= 0) return serve_on(fds[0], engine, handler, false);
+
+    // workers only return when their engine fails, which fails the server.
+    // The rest are left running, so they share this state rather than
+    // pointing into the stack of run().
+    struct Stop {
+        mutex m;
+        condition_variable cv;
+        bool failed = false;
+    };
+    auto stop = make_shared<Stop>();
+    for (int i = 0; i < workers; i++) {
+        thread([i, fd = fds[i], engine, &handler, stop]() {
+            if (!Network::pin_to_core(i)) cerr << "acceptor " << i << ": could not pin to a core\n";
+            serve_on(fd, engine, handler, true);
+            cerr << "acceptor " << i << ": stopped\n";
+            lock_guard<mutex> guard(stop->m);
+            stop->failed = true;
+            stop->cv.notify_one();
+        }).detach();
+    }
+    unique_lock<mutex> lk(stop->m);
+    stop->cv.wait(lk, [&]() { return stop->failed; });
+    return false;
+}
+
+}
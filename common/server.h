@@ -0,0 +1,57 @@
+#pragma once
+#include "stats.h"
+#include "types.h"
+#include <functional>
+#include <string>
+
+// Listening side shared by the replica servers. By default one thread
+// accepts and starts a thread per connection. With acceptors > 0 each of
+// that many workers opens its own SO_REUSEPORT listener on the port, so the
+// kernel spreads connections across them, is pinned to a core, and serves
+// its connections inline.
+//
+// The epoll and io_uring engines replace the blocking socket calls of each
+// worker (or of the single acceptor) with one event loop that multiplexes
+// all of its connections.
+namespace Server {
+    enum Engine { THREADS, EPOLL, IO_URING };
+
+    struct Options {
+        int backlog = 50;
+        int acceptors = 0;
+        Engine engine = THREADS;
+    };
+
+    // What a server does with its connections
+    struct Handler {
+        // THREADS: serve one request on an accepted socket, then close it
+        std::function<void(int)> serve;
+        // Event loops: reply to one request line (without its '\n')
+        std::function<Reply(const std::string&)> handle;
+        // Event loops keep its CONNECTIONS gauge
+        Stats::ServerStats *stats;
+    };
+
+    // Take --backlog, --acceptors or --engine; false if flag is none of them
+    // or its value is invalid (counts must be whole and non-negative)
+    bool parse_option(const std::string &flag, const std::string &val, Options &opts);
+    const char *engine_name(Engine e);
+
+    // Print banner once listening, then serve port until the process
+    // exits; returns false if it could not listen or any worker's engine
+    // failed. IO_URING falls back to EPOLL when the kernel lacks what it
+    // needs.
+    bool run(int port, const Options &opts, const std::string &banner, const Handler &handler);
+
+    // Event loops close a connection that has made no progress for
+    // Config::SOCKET_TIMEOUT_SEC, as the socket timeouts of THREADS do,
+    // checking this often
+    constexpr int IDLE_SWEEP_MS = 250;
+
+    // Event loops over a nonblocking listening socket; they return, false,
+    // only on a fatal error
+    bool serve_epoll(int listen_fd, const Handler &handler);
+    bool serve_uring(int listen_fd, const Handler &handler);
+    // Whether this kernel supports everything serve_uring uses
+    bool uring_supported();
+}
@@ -0,0 +1,145 @@
+#include "server.h"
+#include "network.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace Server {
+
+static const int MAX_EVENTS = 256;
+static const size_t READ_CHUNK = 64 * 1024;
+
+// One request in progress: read up to '\n', reply, close
+struct EpollConn {
+    string in;
+    Reply out;
+    bool replying = false;
+    size_t sent = 0;
+    chrono::steady_clock::time_point deadline;  // pushed back on every read or send
+};
+
+// Send what is left of the reply; false while the socket buffer is full
+static bool flush_reply(int fd, EpollConn &c, chrono::steady_clock::time_point deadline) {
+    while (c.sent < c.out.size()) {
+        msghdr msg{};
+        iovec iov[3];
+        msg.msg_iov = iov;
+        msg.msg_iovlen = Network::reply_iov(c.out, c.sent, iov);
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+        if (n <= 0) return true;    // peer is gone, nothing left to do
+        c.sent += n;
+        c.deadline = deadline;
+    }
+    return true;
+}
+
+bool serve_epoll(int listen_fd, const Handler &handler) {
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    unordered_map<int, EpollConn> conns;
+    epoll_event events[MAX_EVENTS];
+    char buf[READ_CHUNK];
+
+    auto finish = [&](int fd) {
+        close(fd);      // also leaves the epoll set
+        conns.erase(fd);
+        handler.stats->add(Stats::CONNECTIONS, -1);
+    };
+
+    const auto idle = chrono::seconds(Config::SOCKET_TIMEOUT_SEC);
+    const auto sweep_every = chrono::milliseconds(IDLE_SWEEP_MS);
+    auto next_sweep = chrono::steady_clock::now() + sweep_every;
+    vector<int> expired;
+
+    while (true) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, IDLE_SWEEP_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            close(ep);
+            return false;
+        }
+        auto now = chrono::steady_clock::now();
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd) {
+                int sock;
+                while ((sock = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    epoll_event cev{};
+                    cev.events = EPOLLIN;
+                    cev.data.fd = sock;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &cev);
+                    conns[sock].deadline = now + idle;
+                    handler.stats->add(Stats::CONNECTIONS);
+                }
+                continue;
+            }
+
+            auto it = conns.find(fd);
+            if (it == conns.end()) continue;
+            EpollConn &c = it->second;
+
+            // writable again after a partial reply
+            if (c.replying) {
+                if (flush_reply(fd, c, now + idle)) finish(fd);
+                continue;
+            }
+
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            if (r <= 0) {
+                finish(fd);
+                continue;
+            }
+
+            c.deadline = now + idle;
+            size_t scanned = c.in.size();
+            c.in.append(buf, r);
+            size_t nl = c.in.find('\n', scanned);
+            if (nl == string::npos) continue;
+
+            c.in.resize(nl);
+            c.out = handler.handle(c.in);
+            c.replying = true;
+            if (flush_reply(fd, c, now + idle)) {
+                finish(fd);
+                continue;
+            }
+            epoll_event wev{};
+            wev.events = EPOLLOUT;
+            wev.data.fd = fd;
+            epoll_ctl(ep, EPOLL_CTL_MOD, fd, &wev);
+        }
+
+        // drop connections that stopped sending or stopped reading
+        if (now >= next_sweep) {
+            next_sweep = now + sweep_every;
+            expired.clear();
+            for (auto &kv : conns) {
+                if (now >= kv.second.deadline) expired.push_back(kv.first);
+            }
+            for (int fd : expired) finish(fd);
+        }
+    }
+}
+
+}
@@ -0,0 +1,438 @@
+#include "server.h"
+#include "network.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Server {
+
+// No liburing here: the rings are mapped and driven with the raw syscalls
+
+static int uring_setup(unsigned entries, io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, nullptr, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static const unsigned SQ_ENTRIES = 256;
+static const unsigned CQ_ENTRIES = 4096;
+
+// Provided buffers that multishot recvs fill; returned after every use
+static const unsigned RECV_BUFS = 256;     // power of two
+static const unsigned RECV_BUF_SIZE = 4096;
+static const int RECV_GROUP = 0;
+
+// Submission and completion rings of one event loop
+class Ring {
+public:
+    ~Ring() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool init() {
+        io_uring_params p{};
+        p.cq_entries = CQ_ENTRIES;
+        // one thread owns the ring, so completion work can wait for it
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        fd = uring_setup(SQ_ENTRIES, &p);
+        if (fd < 0) {
+            p = io_uring_params{};
+            p.cq_entries = CQ_ENTRIES;
+            p.flags = IORING_SETUP_CQSIZE;
+            fd = uring_setup(SQ_ENTRIES, &p);
+        }
+        if (fd < 0) return false;
+
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = max(sq_size, cq_size);
+
+        char *sq = (char *)mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) return false;
+        char *cq = sq;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            cq = (char *)mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) return false;
+        }
+        sqes = (io_uring_sqe *)mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+
+        sq_head = (unsigned *)(sq + p.sq_off.head);
+        sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + p.sq_off.array);
+        sq_entries = p.sq_entries;
+        local_tail = *sq_tail;
+
+        cq_head = (unsigned *)(cq + p.cq_off.head);
+        cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // Next free submission entry, zeroed. Submits the queued ones first
+    // unless room entries, this one included, are free: the head of a
+    // linked chain asks for the whole chain so it goes in one submission.
+    io_uring_sqe *sqe(unsigned room = 1) {
+        if (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + room > sq_entries) submit(0);
+        unsigned idx = local_tail & sq_mask;
+        io_uring_sqe *e = &sqes[idx];
+        memset(e, 0, sizeof(*e));
+        sq_array[idx] = idx;
+        local_tail++;
+        pending++;
+        return e;
+    }
+
+    // Hand everything queued to the kernel in one call and wait for at
+    // least wait completions
+    int submit(unsigned wait) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        int r = uring_enter(fd, pending, wait, IORING_ENTER_GETEVENTS);
+        if (r > 0) pending -= min((unsigned)r, pending);
+        return r;
+    }
+
+    template <typename F>
+    void reap(F on_cqe) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            // copy out first: on_cqe may queue work that reuses the slot
+            io_uring_cqe c = cqes[head & cq_mask];
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            on_cqe(c);
+        }
+    }
+
+    int fd = -1;
+
+private:
+    io_uring_sqe *sqes = nullptr;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0, local_tail = 0, pending = 0;
+
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+};
+
+// Buffer ring registered with the kernel as group RECV_GROUP
+class RecvBuffers {
+public:
+    ~RecvBuffers() {
+        if (ring) munmap(ring, RECV_BUFS * sizeof(io_uring_buf));
+        if (data) munmap(data, RECV_BUFS * RECV_BUF_SIZE);
+    }
+
+    bool init(int ring_fd) {
+        void *r = mmap(nullptr, RECV_BUFS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void *d = mmap(nullptr, RECV_BUFS * RECV_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED || d == MAP_FAILED) return false;
+        ring = (io_uring_buf_ring *)r;
+        data = (char *)d;
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = (uint64_t)ring;
+        reg.ring_entries = RECV_BUFS;
+        reg.bgid = RECV_GROUP;
+        if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        for (unsigned bid = 0; bid < RECV_BUFS; bid++) put_back(bid);
+        return true;
+    }
+
+    const char *get(unsigned bid) const { return data + (size_t)bid * RECV_BUF_SIZE; }
+
+    void put_back(unsigned bid) {
+        // not ring->bufs: in C++ the header's flexible array sits behind an
+        // empty struct of size 1, eight bytes off from where the kernel looks
+        io_uring_buf *b = (io_uring_buf *)ring + (tail & (RECV_BUFS - 1));
+        b->addr = (uint64_t)get(bid);
+        b->len = RECV_BUF_SIZE;
+        b->bid = bid;
+        tail++;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    io_uring_buf_ring *ring = nullptr;
+    char *data = nullptr;
+    unsigned short tail = 0;
+};
+
+// user_data is the connection id shifted over the operation
+enum UringOp { OP_ACCEPT, OP_RECV, OP_SEND, OP_CLOSE, OP_TIMEOUT, OP_CANCEL };
+
+static uint64_t tag(uint64_t id, UringOp op) {
+    return id << 3 | op;
+}
+
+// One request in progress. Ids are never reused, unlike fds, so late
+// completions of a finished connection cannot reach a new one.
+struct UringConn {
+    int fd = -1;
+    string in;
+    Reply out;
+    size_t sent = 0;
+    // what the pending SENDMSG points at; conns never moves its entries
+    msghdr msg{};
+    iovec iov[3];
+    bool recv_armed = false;
+    bool sending = false;
+    bool closing = false;
+    bool closed = false;
+    bool expired = false;       // its pending ops have been cancelled
+    chrono::steady_clock::time_point deadline;  // pushed back on every recv or send
+};
+
+bool uring_supported() {
+    static int supported = -1;
+    if (supported >= 0) return supported;
+    supported = 0;
+
+    // multishot recv arrived in 6.0
+    utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) != 0 || sscanf(u.release, "%d.%d", &major, &minor) != 2 || major < 6) return false;
+
+    Ring ring;
+    if (!ring.init()) return false;
+
+    vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = (io_uring_probe *)buf.data();
+    if (uring_register(ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+    for (int op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_CLOSE,
+                   IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+
+    RecvBuffers bufs;
+    supported = bufs.init(ring.fd);
+    return supported;
+}
+
+bool serve_uring(int listen_fd, const Handler &handler) {
+    Ring ring;
+    RecvBuffers bufs;
+    if (!ring.init() || !bufs.init(ring.fd)) {
+        perror("io_uring");
+        return false;
+    }
+
+    unordered_map<uint64_t, UringConn> conns;
+    uint64_t next_id = 1;
+
+    const auto idle = chrono::seconds(Config::SOCKET_TIMEOUT_SEC);
+    __kernel_timespec sweep_every{0, (long long)IDLE_SWEEP_MS * 1000000};
+
+    auto arm_accept = [&]() {
+        io_uring_sqe *e = ring.sqe();
+        e->opcode = IORING_OP_ACCEPT;
+        e->fd = listen_fd;
+        e->ioprio = IORING_ACCEPT_MULTISHOT;
+        e->accept_flags = SOCK_CLOEXEC;
+        e->user_data = tag(0, OP_ACCEPT);
+    };
+
+    auto arm_recv = [&](uint64_t id, UringConn &c) {
+        io_uring_sqe *e = ring.sqe();
+        e->opcode = IORING_OP_RECV;
+        e->fd = c.fd;
+        e->ioprio = IORING_RECV_MULTISHOT;
+        e->flags = IOSQE_BUFFER_SELECT;
+        e->buf_group = RECV_GROUP;
+        e->user_data = tag(id, OP_RECV);
+        c.recv_armed = true;
+    };
+
+    auto arm_sweep = [&]() {
+        io_uring_sqe *e = ring.sqe();
+        e->opcode = IORING_OP_TIMEOUT;
+        e->addr = (uint64_t)&sweep_every;
+        e->len = 1;
+        e->user_data = tag(0, OP_TIMEOUT);
+    };
+
+    // Cancel by user_data rather than shutting the fd down: the fd may
+    // already be closed, and reused by another worker
+    auto cancel = [&](uint64_t id, UringOp op) {
+        io_uring_sqe *e = ring.sqe();
+        e->opcode = IORING_OP_ASYNC_CANCEL;
+        e->addr = tag(id, op);
+        e->user_data = tag(id, OP_CANCEL);
+    };
+
+    // Progress: restart the deadline, and let a later sweep cancel whatever
+    // is pending by then
+    auto touch = [&](UringConn &c) {
+        c.deadline = chrono::steady_clock::now() + idle;
+        c.expired = false;
+    };
+
+    // A connection past its deadline loses its pending recv and send; their
+    // completions then close it and free its state as for any failure
+    auto sweep = [&]() {
+        auto now = chrono::steady_clock::now();
+        for (auto &kv : conns) {
+            UringConn &c = kv.second;
+            if (c.expired || now < c.deadline) continue;
+            c.expired = true;
+            if (c.recv_armed) cancel(kv.first, OP_RECV);
+            if (c.sending) cancel(kv.first, OP_SEND);
+        }
+    };
+
+    // Send the rest of the reply, then close; a short send cancels the
+    // linked close and is retried
+    auto send_reply = [&](uint64_t id, UringConn &c) {
+        c.msg = msghdr{};
+        c.msg.msg_iov = c.iov;
+        c.msg.msg_iovlen = Network::reply_iov(c.out, c.sent, c.iov);
+
+        // room for the close too: a full ring would otherwise submit the
+        // send alone and let the close run before it
+        io_uring_sqe *e = ring.sqe(2);
+        e->opcode = IORING_OP_SENDMSG;
+        e->fd = c.fd;
+        e->addr = (uint64_t)&c.msg;
+        e->len = 1;
+        e->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        e->flags = IOSQE_IO_LINK;
+        e->user_data = tag(id, OP_SEND);
+        c.sending = true;
+
+        e = ring.sqe();
+        e->opcode = IORING_OP_CLOSE;
+        e->fd = c.fd;
+        e->user_data = tag(id, OP_CLOSE);
+    };
+
+    auto close_conn = [&](uint64_t id, UringConn &c) {
+        c.closing = true;
+        io_uring_sqe *e = ring.sqe();
+        e->opcode = IORING_OP_CLOSE;
+        e->fd = c.fd;
+        e->user_data = tag(id, OP_CLOSE);
+    };
+
+    // The state goes once the fd is closed and no recv can report on it.
+    // The recv keeps the socket open past its close until the client,
+    // having read the reply, closes its end.
+    auto maybe_free = [&](uint64_t id, UringConn &c) {
+        if (c.closed && !c.recv_armed) {
+            conns.erase(id);
+            handler.stats->add(Stats::CONNECTIONS, -1);
+        }
+    };
+
+    auto on_recv = [&](uint64_t id, UringConn &c, const io_uring_cqe &cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) c.recv_armed = false;
+
+        if (cqe.res > 0) touch(c);
+        if (cqe.res > 0 && !c.closing) {
+            size_t scanned = c.in.size();
+            c.in.append(bufs.get(cqe.flags >> IORING_CQE_BUFFER_SHIFT), cqe.res);
+            size_t nl = c.in.find('\n', scanned);
+            if (nl != string::npos) {
+                c.in.resize(nl);
+                c.out = handler.handle(c.in);
+                c.closing = true;
+
+                send_reply(id, c);
+            }
+        }
+
+        if (!c.recv_armed && !c.closing) {
+            // a multishot recv also stops when it runs out of buffers;
+            // anything but EOF or an error means try again
+            if (cqe.res > 0 || cqe.res == -ENOBUFS) arm_recv(id, c);
+            else close_conn(id, c);
+        }
+        maybe_free(id, c);
+    };
+
+    auto on_cqe = [&](const io_uring_cqe &cqe) {
+        uint64_t id = cqe.user_data >> 3;
+        UringOp op = (UringOp)(cqe.user_data & 7);
+
+        // every buffer goes back, whatever became of its connection
+        bool has_buf = op == OP_RECV && cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER);
+
+        if (op == OP_ACCEPT) {
+            if (cqe.res >= 0) {
+                uint64_t cid = next_id++;
+                UringConn &c = conns[cid];
+                c.fd = cqe.res;
+                c.deadline = chrono::steady_clock::now() + idle;
+                handler.stats->add(Stats::CONNECTIONS);
+                arm_recv(cid, c);
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) arm_accept();
+            return;
+        }
+        if (op == OP_TIMEOUT) {
+            sweep();
+            arm_sweep();
+            return;
+        }
+        if (op == OP_CANCEL) return;
+
+        auto it = conns.find(id);
+        if (it != conns.end()) {
+            UringConn &c = it->second;
+            if (op == OP_RECV) {
+                on_recv(id, c, cqe);
+            } else if (op == OP_SEND) {
+                c.sending = false;
+                if (cqe.res > 0) touch(c);
+                if (cqe.res > 0 && c.sent + cqe.res < c.out.size()) {
+                    c.sent += cqe.res;
+                    send_reply(id, c);
+                } else if (cqe.res < 0) {
+                    // the linked close was cancelled with it
+                    close_conn(id, c);
+                }
+            } else if (op == OP_CLOSE && cqe.res != -ECANCELED) {
+                c.closed = true;
+                maybe_free(id, c);
+            }
+        }
+        if (has_buf) bufs.put_back(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    };
+
+    arm_accept();
+    arm_sweep();
+    while (true) {
+        // one syscall submits all replies and new receives queued by the
+        // last batch of completions and waits for the next
+        if (ring.submit(1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            return false;
+        }
+        ring.reap(on_cqe);
+    }
+}
+
+}
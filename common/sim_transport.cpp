@@ -0,0 +1,332 @@
+#include "sim_transport.h"
+#include "hash.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <tuple>
+
+using namespace std;
+
+namespace Network {
+
+// Position of the calling thread in the fan_out tree. Threads that were not
+// started through fan_out() are unmanaged and never hold up the scheduler.
+struct SimThread {
+    bool managed = false;
+    uint64_t path = 0;
+    uint64_t seq = 0;
+};
+
+static thread_local SimThread self;
+
+static double unit(uint64_t seed, uint64_t path, uint64_t seq, uint64_t salt) {
+    uint64_t h = Hash::mix(seed ^ Hash::mix(path ^ Hash::mix(seq ^ Hash::mix(salt))));
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool parse_link_model(const string &spec, LinkModel &out) {
+    istringstream iss(spec);
+    string dist, base, jitter, drop;
+    getline(iss, dist, ':');
+    getline(iss, base, ':');
+    getline(iss, jitter, ':');
+    getline(iss, drop, ':');
+
+    try {
+        out.base_us = base.empty() ? 0 : stod(base);
+        out.jitter_us = jitter.empty() ? 0 : stod(jitter);
+        if (!drop.empty()) out.drop_rate = stod(drop);
+    } catch (...) {
+        return false;
+    }
+
+    if (dist == "const") out.dist = LinkModel::CONSTANT;
+    else if (dist == "uniform") out.dist = LinkModel::UNIFORM;
+    else if (dist == "exp") out.dist = LinkModel::EXPONENTIAL;
+    else return false;
+    return true;
+}
+
+bool SimTransport::EventOrder::operator()(const Event &a, const Event &b) const {
+    // priority_queue keeps the largest on top, so invert
+    return tie(a.vt, a.path, a.seq, a.kind) > tie(b.vt, b.path, b.seq, b.kind);
+}
+
+SimTransport::SimTransport(uint64_t seed) : seed(seed) {
+    scheduler = thread(&SimTransport::run_scheduler, this);
+}
+
+SimTransport::~SimTransport() {
+    {
+        lock_guard<mutex> guard(mtx);
+        stopping = true;
+    }
+    sched_cv.notify_all();
+    scheduler.join();
+}
+
+void SimTransport::add_replica(const ServerInfo &addr, SimHandler handler, const ReplicaModel &model) {
+    lock_guard<mutex> guard(mtx);
+    replicas.push_back({addr, move(handler), model});
+}
+
+int64_t SimTransport::sample_delay(const LinkModel &link, uint64_t path, uint64_t seq, uint64_t salt) const {
+    double u = unit(seed, path, seq, salt);
+    double d = link.base_us;
+    switch (link.dist) {
+        case LinkModel::CONSTANT:    break;
+        case LinkModel::UNIFORM:     d += u * link.jitter_us; break;
+        case LinkModel::EXPONENTIAL: d += -link.jitter_us * log(1.0 - u); break;
+    }
+    return (int64_t)d;
+}
+
+bool SimTransport::sample_drop(const LinkModel &link, uint64_t path, uint64_t seq, uint64_t salt) const {
+    return link.drop_rate > 0 && unit(seed, path, seq, salt) < link.drop_rate;
+}
+
+int SimTransport::connect(const ServerInfo &srv, int timeout_us) {
+    lock_guard<mutex> guard(mtx);
+    for (size_t r = 0; r < replicas.size(); r++) {
+        if (replicas[r].addr.host == srv.host && replicas[r].addr.port == srv.port) {
+            int id = next_conn++;
+            auto c = make_unique<Conn>();
+            c->replica = r;
+            c->path = self.path;
+            c->timeout_us = timeout_us;
+            conns[id] = move(c);
+            return id;
+        }
+    }
+    return -1;
+}
+
+bool SimTransport::send(int conn, const string &msg) {
+    lock_guard<mutex> guard(mtx);
+    auto it = conns.find(conn);
+    if (it == conns.end()) return false;
+    Conn &c = *it->second;
+    const LinkModel &link = replicas[c.replica].model.link;
+
+    uint64_t seq = ++self.seq;
+    int64_t delay = sample_delay(link, self.path, seq, 1);
+    if (!c.connected) {
+        // the handshake costs one extra round trip before the first request
+        delay += sample_delay(link, self.path, seq, 2) + sample_delay(link, self.path, seq, 3);
+        c.connected = true;
+    }
+
+    if (sample_drop(link, self.path, seq, 4)) {
+        dropped++;
+        return true;
+    }
+
+    string line = msg;
+    while (!line.empty() && line.back() == '\n') line.pop_back();
+    events.push({vnow.load() + delay, self.path, seq, ARRIVE, conn, c.replica, 0, move(line)});
+    return true;
+}
+
+string SimTransport::recv_line(int conn) {
+    unique_lock<mutex> lk(mtx);
+    auto it = conns.find(conn);
+    if (it == conns.end()) return "";
+    Conn &c = *it->second;
+
+    if (c.inbox.empty() && !c.aborted) {
+        block(lk, conn, c, c.timeout_us);
+    }
+
+    if (c.inbox.empty() || c.aborted) return "";
+    string line = move(c.inbox.front());
+    c.inbox.erase(c.inbox.begin());
+    return line;
+}
+
+void SimTransport::block(unique_lock<mutex> &lk, int conn, Conn &c, int64_t timeout_us) {
+    c.waiting = true;
+    c.managed_waiter = self.managed;
+    c.gen++;
+    events.push({vnow.load() + timeout_us, self.path, ++self.seq, TIMEOUT, conn, c.replica, c.gen, ""});
+
+    if (self.managed) runnable--;
+    sched_cv.notify_one();
+    c.cv.wait(lk, [&]() { return !c.waiting; });
+}
+
+void SimTransport::close(int conn) {
+    lock_guard<mutex> guard(mtx);
+    conns.erase(conn);
+}
+
+void SimTransport::abort(int conn) {
+    lock_guard<mutex> guard(mtx);
+    auto it = conns.find(conn);
+    if (it == conns.end()) return;
+    Conn &c = *it->second;
+    c.aborted = true;
+    if (c.waiting) wake(c);
+}
+
+void SimTransport::fan_out(int n, const function<void(int)> &fn) {
+    if (n <= 0) return;
+
+    SimThread parent = self;
+    int remaining = n;
+    {
+        lock_guard<mutex> guard(mtx);
+        runnable += n;
+        // the parent is blocked in join() until the last child hands it back
+        if (parent.managed) runnable--;
+    }
+
+    vector<thread> threads;
+    threads.reserve(n);
+    for (int i = 0; i < n; i++) {
+        threads.emplace_back([&, i]() {
+            self = {true, Hash::mix(parent.path ^ Hash::mix(parent.seq)) + i + 1, 0};
+            fn(i);
+
+            lock_guard<mutex> guard(mtx);
+            runnable--;
+            if (--remaining == 0 && parent.managed) runnable++;
+            sched_cv.notify_one();
+        });
+    }
+    for (auto &t : threads) t.join();
+
+    // successive fan_outs from the same thread get distinct child paths
+    self.seq++;
+}
+
+thread SimTransport::spawn(function<void()> fn) {
+    uint64_t path = Hash::mix(self.path ^ Hash::mix(++self.seq ^ 0x5157ULL));
+    {
+        lock_guard<mutex> guard(mtx);
+        runnable++;
+    }
+
+    return thread([this, path, fn]() {
+        self = {true, path, 0};
+        fn();
+
+        lock_guard<mutex> guard(mtx);
+        runnable--;
+        sched_cv.notify_one();
+    });
+}
+
+void SimTransport::sleep_for(chrono::microseconds d) {
+    unique_lock<mutex> lk(mtx);
+    int id = next_conn++;
+    auto c = make_unique<Conn>();
+    c->replica = -1;
+    c->path = self.path;
+    Conn &ref = *c;
+    conns[id] = move(c);
+
+    block(lk, id, ref, d.count());
+    conns.erase(id);
+}
+
+void SimTransport::wait_for(Signal &s, unique_lock<mutex> &caller, chrono::microseconds d) {
+    // take mtx before letting go of the caller's lock so a notify_all()
+    // issued right after cannot slip past us
+    unique_lock<mutex> lk(mtx);
+    caller.unlock();
+
+    int id = next_conn++;
+    auto c = make_unique<Conn>();
+    c->replica = -1;
+    c->path = self.path;
+    Conn &ref = *c;
+    conns[id] = move(c);
+    s.waiters.push_back(id);
+
+    block(lk, id, ref, d.count());
+    s.waiters.erase(find(s.waiters.begin(), s.waiters.end(), id));
+    conns.erase(id);
+
+    lk.unlock();
+    caller.lock();
+}
+
+void SimTransport::notify_all(Signal &s) {
+    lock_guard<mutex> guard(mtx);
+    for (int id : s.waiters) {
+        auto it = conns.find(id);
+        if (it != conns.end() && it->second->waiting) wake(*it->second);
+    }
+}
+
+chrono::steady_clock::time_point SimTransport::now() {
+    return chrono::steady_clock::time_point(chrono::microseconds(vnow.load()));
+}
+
+void SimTransport::wake(Conn &c) {
+    c.waiting = false;
+    if (c.managed_waiter) runnable++;
+    c.cv.notify_one();
+}
+
+void SimTransport::run_scheduler() {
+    unique_lock<mutex> lk(mtx);
+    while (true) {
+        sched_cv.wait(lk, [&]() { return stopping || (runnable == 0 && !events.empty()); });
+        if (stopping) return;
+
+        Event ev = events.top();
+        events.pop();
+
+        auto it = conns.find(ev.conn);
+        Conn *c = it == conns.end() ? nullptr : it->second.get();
+
+        switch (ev.kind) {
+        case ARRIVE: {
+            // requests queue behind each other at a replica
+            vnow = ev.vt;
+            Replica &r = replicas[ev.replica];
+            int64_t start = max(ev.vt, r.busy_until);
+            if (r.model.pause_every_us > 0) {
+                int64_t every = (int64_t)r.model.pause_every_us;
+                if (start % every < (int64_t)r.model.pause_us) start += (int64_t)r.model.pause_us - start % every;
+            }
+            r.busy_until = start + (int64_t)r.model.service_us;
+            ev.vt = r.busy_until;
+            ev.kind = EXECUTE;
+            events.push(move(ev));
+            break;
+        }
+        case EXECUTE: {
+            vnow = ev.vt;
+            Replica &r = replicas[ev.replica];
+            string reply = r.handler(ev.payload);
+            delivered++;
+            if (sample_drop(r.model.link, ev.path, ev.seq, 5)) {
+                dropped++;
+                break;
+            }
+            while (!reply.empty() && reply.back() == '\n') reply.pop_back();
+            int64_t delay = sample_delay(r.model.link, ev.path, ev.seq, 6);
+            events.push({ev.vt + delay, ev.path, ev.seq, REPLY, ev.conn, ev.replica, 0, move(reply)});
+            break;
+        }
+        case REPLY:
+            // replies to connections the client already closed just vanish
+            if (!c) break;
+            vnow = ev.vt;
+            c->inbox.push_back(move(ev.payload));
+            if (c->waiting) wake(*c);
+            break;
+        case TIMEOUT:
+            // stale unless the connection is still in the same recv_line()
+            if (!c || !c->waiting || c->gen != ev.gen) break;
+            vnow = ev.vt;
+            if (c->replica >= 0) timed_out++;
+            wake(*c);
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "network.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Network {
+    // One-way delay and loss of a client <-> replica link, in microseconds
+    struct LinkModel {
+        enum Dist { CONSTANT, UNIFORM, EXPONENTIAL };
+        Dist dist = EXPONENTIAL;
+        double base_us = 50;
+        double jitter_us = 20;      // UNIFORM: width, EXPONENTIAL: mean
+        double drop_rate = 0.0;     // per message, each direction
+    };
+
+    struct ReplicaModel {
+        LinkModel link;
+        double service_us = 5;      // time the replica is busy per request
+        // Stalls for pause_us at the start of every pause_every_us, like a
+        // GC pause; 0 disables
+        double pause_every_us = 0;
+        double pause_us = 0;
+    };
+
+    // Parse "const:<base>", "uniform:<base>:<width>" or "exp:<base>:<mean>",
+    // optionally followed by ":<drop_rate>"
+    bool parse_link_model(const std::string &spec, LinkModel &out);
+
+    // Executes one request line and returns the reply line
+    typedef std::function<std::string(const std::string&)> SimHandler;
+
+    // In-process transport: requests are delivered to replica state machines
+    // on a virtual clock instead of going over sockets.
+    //
+    // A single scheduler thread pops events in (virtual time, origin) order
+    // and only advances once every thread started through fan_out() is
+    // blocked in recv_line() or finished, so client code runs one step at a
+    // time. Delays and drops are drawn from a hash of the seed and the
+    // sending thread's position in the fan_out tree, which makes a run
+    // reproducible from its seed.
+    class SimTransport : public Transport {
+    public:
+        explicit SimTransport(uint64_t seed);
+        ~SimTransport() override;
+
+        // Register a replica reachable at addr; call before any traffic
+        void add_replica(const ServerInfo &addr, SimHandler handler, const ReplicaModel &model);
+
+        int connect(const ServerInfo &srv, int timeout_us) override;
+        bool send(int conn, const std::string &msg) override;
+        std::string recv_line(int conn) override;
+        void close(int conn) override;
+        void abort(int conn) override;
+        void fan_out(int n, const std::function<void(int)> &fn) override;
+        std::thread spawn(std::function<void()> fn) override;
+        void sleep_for(std::chrono::microseconds d) override;
+        void wait_for(Signal &s, std::unique_lock<std::mutex> &lk, std::chrono::microseconds d) override;
+        void notify_all(Signal &s) override;
+        std::chrono::steady_clock::time_point now() override;
+
+        long long messages_delivered() const { return delivered.load(); }
+        long long messages_dropped() const { return dropped.load(); }
+        long long timeouts() const { return timed_out.load(); }
+
+    private:
+        enum Kind { ARRIVE, EXECUTE, REPLY, TIMEOUT };
+
+        struct Event {
+            int64_t vt;
+            uint64_t path;
+            uint64_t seq;
+            Kind kind;
+            int conn;
+            int replica;
+            uint64_t gen;
+            std::string payload;
+        };
+
+        struct EventOrder {
+            bool operator()(const Event &a, const Event &b) const;
+        };
+
+        struct Replica {
+            ServerInfo addr;
+            SimHandler handler;
+            ReplicaModel model;
+            int64_t busy_until = 0;
+        };
+
+        // replica is -1 for the pseudo-connections behind sleep_for() and wait_for()
+        struct Conn {
+            int replica;
+            uint64_t path;
+            int timeout_us = DEFAULT_TIMEOUT_US;
+            bool connected = false;
+            bool waiting = false;
+            bool managed_waiter = false;
+            bool aborted = false;
+            uint64_t gen = 0;
+            std::vector<std::string> inbox;
+            std::condition_variable cv;
+        };
+
+        int64_t sample_delay(const LinkModel &link, uint64_t path, uint64_t seq, uint64_t salt) const;
+        bool sample_drop(const LinkModel &link, uint64_t path, uint64_t seq, uint64_t salt) const;
+        void wake(Conn &c);
+        // Block the calling thread until c is woken; caller holds lk
+        void block(std::unique_lock<std::mutex> &lk, int conn, Conn &c, int64_t timeout_us);
+        void run_scheduler();
+
+        uint64_t seed;
+        std::mutex mtx;
+        std::condition_variable sched_cv;
+        std::priority_queue<Event, std::vector<Event>, EventOrder> events;
+        std::vector<Replica> replicas;
+        std::unordered_map<int, std::unique_ptr<Conn>> conns;
+        int next_conn = 1;
+        int runnable = 0;
+        bool stopping = false;
+
+        std::atomic<int64_t> vnow{0};
+        std::atomic<long long> delivered{0};
+        std::atomic<long long> dropped{0};
+        std::atomic<long long> timed_out{0};
+
+        std::thread scheduler;
+    };
+}
@@ -0,0 +1,96 @@
+#include "single_flight.h"
+#include "network.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+namespace SingleFlight {
+
+struct Flight {
+    bool done = false;
+    bool ok = false;
+    string value;
+    Network::Signal finished;
+};
+
+struct Slot {
+    shared_ptr<Flight> running;     // started before anyone now waiting on next
+    shared_ptr<Flight> next;        // batch that starts once running is done
+};
+
+static bool on = false;
+static mutex slots_lock;
+static unordered_map<string, Slot> slots;
+static atomic<long long> calls{0}, flights{0};
+
+void set_enabled(bool enable) {
+    on = enable;
+}
+
+bool enabled() {
+    return on;
+}
+
+static void wait_done(const shared_ptr<Flight> &f, unique_lock<mutex> &lk) {
+    while (!f->done) {
+        Network::wait_for(f->finished, lk, chrono::microseconds(Network::DEFAULT_TIMEOUT_US));
+    }
+}
+
+bool run(const string &key, const function<bool(string&)> &read, string &out) {
+    if (!on) return read(out);
+    calls.fetch_add(1, memory_order_relaxed);
+
+    unique_lock<mutex> lk(slots_lock);
+    Slot &slot = slots[key];
+    shared_ptr<Flight> mine;
+
+    if (slot.next) {
+        // join a batch that has not started yet, even if the flight before
+        // it is done and its leader is still waking up
+        shared_ptr<Flight> f = slot.next;
+        wait_done(f, lk);
+        out = f->value;
+        return f->ok;
+    } else if (!slot.running) {
+        mine = make_shared<Flight>();
+        slot.running = mine;
+    } else {
+        // lead the next batch once the operation in flight is done
+        mine = make_shared<Flight>();
+        slot.next = mine;
+        shared_ptr<Flight> prev = slot.running;
+        wait_done(prev, lk);
+
+        Slot &s = slots[key];
+        s.running = mine;
+        s.next = nullptr;
+    }
+    lk.unlock();
+
+    flights.fetch_add(1, memory_order_relaxed);
+    string value;
+    bool ok = read(value);
+
+    lk.lock();
+    mine->ok = ok;
+    mine->value = value;
+    mine->done = true;
+    Slot &s = slots[key];
+    if (s.running == mine) s.running = nullptr;
+    if (!s.running && !s.next) slots.erase(key);
+    Network::notify_all(mine->finished);
+    lk.unlock();
+
+    out = move(value);
+    return ok;
+}
+
+Counters counters() {
+    return {calls.load(), flights.load()};
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <functional>
+#include <string>
+
+// Merges concurrent reads of one key within this process into a single
+// quorum operation whose result every caller gets.
+//
+// To stay linearizable a caller only shares an operation that starts after
+// it arrived: while one is in flight, newcomers queue as the next batch, and
+// the first of them runs it for all once the current one is done.
+namespace SingleFlight {
+    struct Counters {
+        long long calls;        // reads that went through run()
+        long long flights;      // quorum operations actually executed
+    };
+
+    // Off by default; set once at startup before any traffic
+    void set_enabled(bool on);
+    bool enabled();
+
+    // Run read (or share a batch's run of it) for key and return its result;
+    // key must identify everything the result depends on
+    bool run(const std::string &key, const std::function<bool(std::string&)> &read, std::string &out);
+
+    Counters counters();
+}
@@ -0,0 +1,140 @@
+#include "stats.h"
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace Stats {
+
+static const char *CMD_NAMES[NUM_CMDS] = {"READ_REQ", "WRITE_REQ", "LOCK_REQ", "UNLOCK", "STATS", "PING", "OWN", "SYNC", "RANGE", "OTHER"};
+
+static atomic<int> next_shard{0};
+
+static int bucket_of(long long ns) {
+    int b = 0;
+    while (ns > 1 && b < HIST_BUCKETS - 1) {
+        ns >>= 1;
+        b++;
+    }
+    return b;
+}
+
+Cmd classify(const string &msg) {
+    string cmd = msg.substr(0, msg.find(' '));
+    for (int c = 0; c < OTHER; c++) {
+        if (cmd == CMD_NAMES[c]) return (Cmd)c;
+    }
+    return OTHER;
+}
+
+const char *cmd_name(Cmd cmd) {
+    return CMD_NAMES[cmd];
+}
+
+ServerStats::ServerStats() : started(chrono::steady_clock::now()) {
+    for (auto &s : shards) {
+        for (auto &c : s.counts) c.store(0);
+        for (auto &row : s.hist) for (auto &h : row) h.store(0);
+        for (auto &c : s.counters) c.store(0);
+    }
+}
+
+ServerStats::Shard &ServerStats::local() {
+    static thread_local int idx = next_shard.fetch_add(1) % SHARDS;
+    return shards[idx];
+}
+
+void ServerStats::record(Cmd cmd, long long service_ns) {
+    Shard &s = local();
+    s.counts[cmd].fetch_add(1, memory_order_relaxed);
+    s.hist[cmd][bucket_of(service_ns)].fetch_add(1, memory_order_relaxed);
+}
+
+void ServerStats::add(Counter c, long long v) {
+    local().counters[c].fetch_add(v, memory_order_relaxed);
+}
+
+long long ServerStats::total(Counter c) const {
+    long long sum = 0;
+    for (auto &s : shards) sum += s.counters[c].load(memory_order_relaxed);
+    return sum;
+}
+
+long long ServerStats::count(Cmd cmd) const {
+    long long sum = 0;
+    for (auto &s : shards) sum += s.counts[cmd].load(memory_order_relaxed);
+    return sum;
+}
+
+string ServerStats::render(const string &extra) const {
+    double uptime = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    ostringstream oss;
+    oss << "uptime_s=" << uptime
+        << " connections=" << total(CONNECTIONS)
+        << " threads=" << total(THREADS)
+        << " lock_wait_ns=" << total(LOCK_WAIT_NS)
+        << " lock_acquires=" << total(LOCK_ACQUIRES);
+
+    for (int c = 0; c < NUM_CMDS; c++) {
+        long long hist[HIST_BUCKETS] = {0};
+        long long n = 0;
+        for (auto &s : shards) {
+            for (int b = 0; b < HIST_BUCKETS; b++) hist[b] += s.hist[c][b].load(memory_order_relaxed);
+        }
+        for (long long h : hist) n += h;
+        if (n == 0) continue;
+
+        // percentiles are reported as the upper bound of their bucket
+        long long p50 = 0, p99 = 0, seen = 0;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            seen += hist[b];
+            if (!p50 && seen * 100 >= n * 50) p50 = 2LL << b;
+            if (!p99 && seen * 100 >= n * 99) p99 = 2LL << b;
+        }
+
+        const char *name = CMD_NAMES[c];
+        oss << " " << name << ".count=" << n
+            << " " << name << ".rate=" << (uptime > 0 ? n / uptime : 0.0)
+            << " " << name << ".p50_ns=" << p50
+            << " " << name << ".p99_ns=" << p99
+            << " " << name << ".hist=";
+        bool first = true;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            if (!hist[b]) continue;
+            oss << (first ? "" : ",") << b << ":" << hist[b];
+            first = false;
+        }
+    }
+
+    if (!extra.empty()) oss << " " << extra;
+    return oss.str();
+}
+
+TimedLock::TimedLock(mutex &m, ServerStats &stats) : m(m) {
+    if (m.try_lock()) {
+        stats.add(LOCK_ACQUIRES);
+        return;
+    }
+    auto t0 = chrono::steady_clock::now();
+    m.lock();
+    stats.add(LOCK_WAIT_NS, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+    stats.add(LOCK_ACQUIRES);
+}
+
+TimedLock::~TimedLock() {
+    m.unlock();
+}
+
+void start_dumper(int interval_sec, function<string()> snapshot) {
+    if (interval_sec <= 0) return;
+    thread([interval_sec, snapshot]() {
+        while (true) {
+            this_thread::sleep_for(chrono::seconds(interval_sec));
+            cout << "[stats] " << snapshot() << endl;
+        }
+    }).detach();
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Server-side counters. Every thread updates its own cache-line aligned
+// shard with relaxed atomics, so recording never contends; readers sum the
+// shards.
+namespace Stats {
+    enum Cmd { READ_REQ, WRITE_REQ, LOCK_REQ, UNLOCK, STATS, PING, OWN, SYNC, RANGE, OTHER, NUM_CMDS };
+
+    // Bucket b counts service times in [2^b, 2^(b+1)) ns
+    constexpr int HIST_BUCKETS = 32;
+
+    // CONNECTIONS and THREADS are gauges: add +1 on open, -1 on close
+    enum Counter {
+        LOCK_WAIT_NS, LOCK_ACQUIRES,
+        CONNECTIONS, THREADS,
+        LOCKS_GRANTED, LOCKS_DENIED, LEASES_EXPIRED,
+        OWNER_REJECTS,
+        SYNC_ROUNDS, SYNC_RANGES_REPAIRED, SYNC_KEYS_PUSHED, SYNC_KEYS_PULLED,
+        NUM_COUNTERS
+    };
+
+    Cmd classify(const std::string &msg);
+    const char *cmd_name(Cmd cmd);
+
+    class ServerStats {
+    public:
+        ServerStats();
+
+        void record(Cmd cmd, long long service_ns);
+        void add(Counter c, long long v = 1);
+
+        long long total(Counter c) const;
+        long long count(Cmd cmd) const;
+
+        // One line of "name=value" pairs; extra is appended verbatim
+        std::string render(const std::string &extra) const;
+
+    private:
+        static constexpr int SHARDS = 16;
+
+        struct alignas(64) Shard {
+            std::atomic<long long> counts[NUM_CMDS];
+            std::atomic<long long> hist[NUM_CMDS][HIST_BUCKETS];
+            std::atomic<long long> counters[NUM_COUNTERS];
+        };
+
+        Shard &local();
+
+        Shard shards[SHARDS];
+        std::chrono::steady_clock::time_point started;
+    };
+
+    // lock_guard that records how long it waited for the mutex
+    class TimedLock {
+    public:
+        TimedLock(std::mutex &m, ServerStats &stats);
+        ~TimedLock();
+    private:
+        std::mutex &m;
+    };
+
+    // Print "[stats] <snapshot()>" every interval_sec on a background thread
+    void start_dumper(int interval_sec, std::function<std::string()> snapshot);
+}
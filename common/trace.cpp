@@ -0,0 +1,149 @@
+#include "trace.h"
+#include "network.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+namespace Trace {
+
+struct ThreadBuffer {
+    vector<OpTrace> ring;
+    atomic<long long> count{0};
+};
+
+static atomic<bool> on{false};
+
+static mutex registry_lock;
+static vector<shared_ptr<ThreadBuffer>> registry;
+
+static thread_local ThreadBuffer *local = nullptr;
+static thread_local OpTrace *current = nullptr;
+static thread_local int current_group = 0;
+
+static int32_t us_between(chrono::steady_clock::time_point a, chrono::steady_clock::time_point b) {
+    return (int32_t)chrono::duration_cast<chrono::microseconds>(b - a).count();
+}
+
+static ThreadBuffer &buffer() {
+    if (!local) {
+        auto buf = make_shared<ThreadBuffer>();
+        buf->ring.resize(BUFFER_OPS);
+        lock_guard<mutex> guard(registry_lock);
+        registry.push_back(buf);
+        local = buf.get();
+    }
+    return *local;
+}
+
+void set_enabled(bool enable) {
+    on.store(enable);
+}
+
+bool enabled() {
+    return on.load(memory_order_relaxed);
+}
+
+int PhaseTrace::straggler() const {
+    int slow = -1;
+    for (int i = 0; i < (int)rpcs.size(); i++) {
+        if (rpcs[i].replica < 0) continue;
+        if (slow == -1 || rpcs[i].total_us > rpcs[slow].total_us) slow = i;
+    }
+    return slow;
+}
+
+Op::Op(OpKind kind, int client_id) : rec(nullptr) {
+    if (!enabled()) return;
+
+    ThreadBuffer &buf = buffer();
+    rec = &buf.ring[buf.count.load(memory_order_relaxed) % BUFFER_OPS];
+    rec->kind = kind;
+    rec->ok = false;
+    rec->client_id = client_id;
+    rec->group = (int16_t)current_group;
+    rec->total_us = 0;
+    for (auto &ph : rec->phases) {
+        ph.used = false;
+        ph.rpcs.clear();
+    }
+    rec->start = Network::now();
+    current = rec;
+}
+
+Op::~Op() {
+    if (!rec) return;
+    rec->total_us = us_between(rec->start, Network::now());
+    current = nullptr;
+    local->count.fetch_add(1, memory_order_release);
+}
+
+void Op::set_ok(bool ok) {
+    if (rec) rec->ok = ok;
+}
+
+GroupScope::GroupScope(int g) : prev(current_group) {
+    current_group = g;
+}
+
+GroupScope::~GroupScope() {
+    current_group = prev;
+}
+
+PhaseScope::PhaseScope(Phase phase, int n) : ph(nullptr) {
+    if (!current) return;
+    ph = &current->phases[phase];
+    ph->used = true;
+    ph->rpcs.assign(n, RpcTrace());
+    op_start = current->start;
+    t0 = Network::now();
+    ph->offset_us = us_between(op_start, t0);
+}
+
+PhaseScope::~PhaseScope() {
+    if (!ph) return;
+    ph->dur_us = us_between(t0, Network::now());
+}
+
+RpcTimer::RpcTimer(PhaseTrace *ph, int slot, int replica) : rpc(nullptr) {
+    if (!ph || slot >= (int)ph->rpcs.size()) return;
+    rpc = &ph->rpcs[slot];
+    rpc->replica = (int16_t)replica;
+    t0 = Network::now();
+}
+
+void RpcTimer::connected() {
+    if (rpc) rpc->connect_us = us_between(t0, Network::now());
+}
+
+void RpcTimer::done(bool ok) {
+    if (!rpc) return;
+    rpc->total_us = us_between(t0, Network::now());
+    rpc->ok = ok;
+}
+
+vector<OpTrace> collect() {
+    vector<OpTrace> out;
+    lock_guard<mutex> guard(registry_lock);
+    for (auto &buf : registry) {
+        long long cnt = buf->count.load(memory_order_acquire);
+        long long first = cnt > BUFFER_OPS ? cnt - BUFFER_OPS : 0;
+        for (long long i = first; i < cnt; i++) {
+            out.push_back(buf->ring[i % BUFFER_OPS]);
+        }
+    }
+    return out;
+}
+
+long long overwritten() {
+    long long lost = 0;
+    lock_guard<mutex> guard(registry_lock);
+    for (auto &buf : registry) {
+        long long cnt = buf->count.load(memory_order_acquire);
+        if (cnt > BUFFER_OPS) lost += cnt - BUFFER_OPS;
+    }
+    return lost;
+}
+
+}
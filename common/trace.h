@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Per-operation client tracing, off until set_enabled(true). Each client
+// thread records into its own ring buffer, so recording takes no locks; a
+// phase's RPCs each write their own slot. Timestamps come from
+// Network::now(), so simulated runs are traced in virtual time.
+namespace Trace {
+    constexpr int BUFFER_OPS = 1024;    // per thread, oldest overwritten first
+
+    enum OpKind : uint8_t { GET, PUT };
+
+    // ABD uses READ for its query phase and WRITE for write-back/propagation
+    enum Phase : uint8_t { LOCK, READ, WRITE, UNLOCK, NUM_PHASES };
+
+    struct RpcTrace {
+        int16_t replica = -1;           // index within the op's group
+        bool ok = false;
+        int32_t connect_us = 0;
+        int32_t total_us = 0;
+    };
+
+    struct PhaseTrace {
+        bool used = false;
+        int32_t offset_us = 0;          // from the start of the op
+        int32_t dur_us = 0;
+        // one slot per replica asked; empty unless used, and a reused ring
+        // entry keeps its capacity, so steady-state recording never allocates
+        std::vector<RpcTrace> rpcs;
+
+        // Index into rpcs of the slowest replica, or -1
+        int straggler() const;
+    };
+
+    struct OpTrace {
+        OpKind kind = GET;
+        bool ok = false;
+        int client_id = 0;
+        int16_t group = 0;              // replica group the op ran on
+        int32_t total_us = 0;
+        std::chrono::steady_clock::time_point start;
+        PhaseTrace phases[NUM_PHASES];
+    };
+
+    void set_enabled(bool on);
+    bool enabled();
+
+    // Scope of one client operation on the calling thread
+    class Op {
+    public:
+        Op(OpKind kind, int client_id);
+        ~Op();
+        void set_ok(bool ok);
+    private:
+        OpTrace *rec;
+    };
+
+    // Ops started on this thread while in scope ran on replica group g;
+    // outside any scope they count as group 0
+    class GroupScope {
+    public:
+        explicit GroupScope(int g);
+        ~GroupScope();
+    private:
+        int prev;
+    };
+
+    // Scope of one quorum phase inside the current Op; get() is nullptr when
+    // tracing is off or there is no Op on this thread
+    class PhaseScope {
+    public:
+        PhaseScope(Phase phase, int n);
+        ~PhaseScope();
+        PhaseTrace *get() const { return ph; }
+    private:
+        PhaseTrace *ph;
+        std::chrono::steady_clock::time_point t0;
+        std::chrono::steady_clock::time_point op_start;
+    };
+
+    // Times one request/response exchange with a replica
+    class RpcTimer {
+    public:
+        RpcTimer(PhaseTrace *ph, int slot, int replica);
+        void connected();
+        void done(bool ok);
+    private:
+        RpcTrace *rpc;
+        std::chrono::steady_clock::time_point t0;
+    };
+
+    // Copy out every thread's buffered ops; call once client threads are idle
+    std::vector<OpTrace> collect();
+    // Ops that were overwritten before collection
+    long long overwritten();
+}
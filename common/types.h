@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <chrono>
+#include <memory>
 
 struct ServerInfo {
     std::string host;
@@ -14,10 +15,36 @@ struct ReadResp {
     bool valid = false;
 };
 
+// Stored values are immutable and shared: a write swaps in a new buffer and
+// a read keeps the old one alive while it is sent. Null means "".
+typedef std::shared_ptr<const std::string> Value;
+
+inline Value make_value(std::string s) {
+    return std::make_shared<const std::string>(std::move(s));
+}
+
+inline size_t value_size(const Value &v) {
+    return v ? v->size() : 0;
+}
+
+// A reply line in pieces, so a stored value is sent from its buffer instead
+// of being copied into the line: head, then *value if set, then tail
+struct Reply {
+    std::string head;
+    Value value;
+    std::string tail;
+
+    Reply(const char *line = "") : head(line) {}
+    Reply(std::string line) : head(std::move(line)) {}
+
+    size_t size() const { return head.size() + value_size(value) + tail.size(); }
+    std::string str() const { return head + (value ? *value : "") + tail; }
+};
+
 struct KeyState {
     int tag_lamport = 0;
     int tag_cid = 0;
-    std::string value = "";
+    Value value;
     
     int locked_by = -1;
     std::chrono::steady_clock::time_point lock_expiry;
@@ -26,4 +53,10 @@ struct KeyState {
 namespace Config {
     constexpr int SOCKET_TIMEOUT_SEC = 1;
     constexpr int LOCK_LEASE_SEC = 5;
+
+    // Adaptive client timeouts: RTO = SRTT + 4 * RTTVAR, clamped to
+    // [MIN_RTO_US, SOCKET_TIMEOUT_SEC]
+    constexpr int MIN_RTO_US = 10000;
+    constexpr int SUSPECT_AFTER_FAILURES = 3;
+    constexpr int PROBE_INTERVAL_MS = 200;
 }
\ No newline at end of file
@@ -14,12 +14,38 @@ NUM_KEYS=10
 CLIENT_SWEEP=(1 2 4 8 12 16 20 24 32)
 WORKLOADS=("0.9" "0.1")
 
+# Groups of 3 replicas to partition the keys across, beyond the single group
+# of the N=3 runs
+GROUP_SWEEP=(2 4)
+
+# Value sizes in bytes for the MB/s runs on N=3; each client moves at most
+# VALUE_SWEEP_BYTES of values so the large sizes finish in time
+VALUE_SIZE_SWEEP=(100 4096 65536 1048576)
+VALUE_SWEEP_CLIENTS=(1 8)
+VALUE_SWEEP_BYTES=$((64 * 1024 * 1024))
+
+# Thousands of clients as coroutines on a few loop threads, against N=3
+# servers relaunched with an engine and backlog that keep up with them
+COROUTINE_CLIENT_SWEEP=(256 1024 4096)
+COROUTINE_LOOPS=2
+COROUTINE_OPS_PER_CLIENT=100
+COROUTINE_SERVER_OPTS=(--engine epoll --backlog 4096)
+
+# ABD read:write quorum sizes to sweep per N; each must satisfy R+W>N, W>N/2
+quorums_for() {
+    case "$1" in
+        1)  echo "1:1" ;;
+        3)  echo "2:2 1:3" ;;
+        5)  echo "3:3 2:4 1:5" ;;
+    esac
+}
+
 timestamp=$(date +"%Y%m%d_%H%M%S")
 RESULT_DIR=results/$timestamp
 mkdir -p "$RESULT_DIR"
 
 CSV_FILE=$RESULT_DIR/results.csv
-echo "protocol,N,clients,get_fraction,throughput,get_median,get_p95,put_median,put_p95,succ_get,succ_put,fail" \
+echo "protocol,N,groups,read_quorum,write_quorum,clients,get_fraction,value_size,loops,throughput,value_mb_s,get_median,get_p95,put_median,put_p95,succ_get,succ_put,fail" \
     > "$CSV_FILE"
 
 port_for() {
@@ -29,6 +55,8 @@ port_for() {
         1)  echo $((15000 + idx)) ;;
         3)  echo $((15100 + idx)) ;;
         5)  echo $((15200 + idx)) ;;
+        6)  echo $((15300 + idx)) ;;
+        12) echo $((15400 + idx)) ;;
         *)  echo "INVALID_N" >&2; exit 1 ;;
     esac
 }
@@ -49,6 +77,8 @@ wait_for_server() {
 launch_servers() {
     local protocol=$1
     local N=$2
+    shift 2
+    local server_opts=("$@")
 
     echo "Launching $N $protocol servers…"
 
@@ -58,9 +88,9 @@ launch_servers() {
         local logf="$RESULT_DIR/${protocol}_N${N}_server${i}.log"
 
         if [[ "$protocol" == "abd" ]]; then
-            "$SERVER_BIN_ABD" "$port" > "$logf" 2>&1 &
+            "$SERVER_BIN_ABD" "$port" "${server_opts[@]}" > "$logf" 2>&1 &
         else
-            "$SERVER_BIN_BLOCKING" "$port" > "$logf" 2>&1 &
+            "$SERVER_BIN_BLOCKING" "$port" "${server_opts[@]}" > "$logf" 2>&1 &
         fi
 
         sleep 0.2
@@ -88,22 +118,50 @@ run_workload() {
     local clients=$2
     local get_frac=$3
     local N=$4
+    local R=${5:-}
+    local W=${6:-}
+    local G=${7:-1}
+    local V=${8:-}
+    local L=${9:-}
 
     local servers=""
     for ((i=0; i<N; i++)); do
         servers+=" ${SERVER_HOST}:$(port_for "$N" "$i")"
     done
 
-    local logf="$RESULT_DIR/${protocol}_N${N}_C${clients}_GET${get_frac}.log"
-
-    echo "Running workload: protocol=$protocol, N=$N, clients=$clients, GET=$get_frac"
-
-    "$CLIENT_BIN" "$protocol" "$clients" "$OPS_PER_CLIENT" "$get_frac" "$NUM_KEYS" $servers \
+    # workload flags of the sweep this run belongs to, also named in tag
+    local tag="" extra_opts=()
+    if [[ -n "$R" ]]; then
+        tag="_R${R}W${W}"
+        extra_opts=(--read-quorum "$R" --write-quorum "$W")
+    fi
+    if (( G > 1 )); then
+        tag+="_G${G}"
+        extra_opts+=(--groups "$G")
+    fi
+    local ops=$OPS_PER_CLIENT
+    if [[ -n "$V" ]]; then
+        tag+="_V${V}"
+        extra_opts+=(--value-size "$V")
+        (( VALUE_SWEEP_BYTES / V < ops )) && ops=$(( VALUE_SWEEP_BYTES / V ))
+    fi
+    if [[ -n "$L" ]]; then
+        tag+="_L${L}"
+        extra_opts+=(--coroutines "$L")
+        ops=$COROUTINE_OPS_PER_CLIENT
+    fi
+
+    local logf="$RESULT_DIR/${protocol}_N${N}${tag}_C${clients}_GET${get_frac}.log"
+
+    echo "Running workload: protocol=$protocol, N=$N, groups=$G${R:+, R=$R, W=$W}${V:+, value=${V}B}${L:+, loops=$L}, clients=$clients, GET=$get_frac"
+
+    "$CLIENT_BIN" "$protocol" "$clients" "$ops" "$get_frac" "$NUM_KEYS" $servers "${extra_opts[@]}" \
         > "$logf" 2>&1
 
-    local throughput succ_get succ_put fail get_med get_p95 put_med put_p95
+    local throughput mb_s succ_get succ_put fail get_med get_p95 put_med put_p95
 
     throughput=$(grep "Throughput:"    "$logf" | awk '{print $2}')
+    mb_s=$(grep "Value MB/s:"          "$logf" | awk '{print $3}')
     succ_get=$(grep "GET success:"     "$logf" | awk '{print $3}')
     succ_put=$(grep "PUT success:"     "$logf" | awk '{print $3}')
     fail=$(grep "FAIL count:"          "$logf" | awk '{print $3}')
@@ -112,7 +170,7 @@ run_workload() {
     put_med=$(grep "PUT median:"       "$logf" | awk '{print $3}')
     put_p95=$(grep "PUT p95:"          "$logf" | awk '{print $3}')
 
-    echo "$protocol,$N,$clients,$get_frac,$throughput,$get_med,$get_p95,$put_med,$put_p95,$succ_get,$succ_put,$fail" \
+    echo "$protocol,$N,$G,$R,$W,$clients,$get_frac,$V,$L,$throughput,$mb_s,$get_med,$get_p95,$put_med,$put_p95,$succ_get,$succ_put,$fail" \
         >> "$CSV_FILE"
 }
 
@@ -128,7 +186,7 @@ for protocol in "abd" "blocking"; do
     pkill -f blocking_server  2>/dev/null || true
 
     # Free all high ports we use
-    for p in {15000..15010} {15100..15110} {15200..15210}; do
+    for p in {15000..15010} {15100..15110} {15200..15210} {15300..15310} {15400..15415}; do
         fuser -k ${p}/tcp 2>/dev/null || true
     done
     sleep 1
@@ -136,9 +194,54 @@ for protocol in "abd" "blocking"; do
     for N in 1 3 5; do
         launch_servers "$protocol" "$N"
 
+        # blocking always locks a majority
+        quorums="majority"
+        [[ "$protocol" == "abd" ]] && quorums=$(quorums_for "$N")
+
+        for q in $quorums; do
+            read_q="" write_q=""
+            [[ "$q" != "majority" ]] && read_q=${q%%:*} && write_q=${q##*:}
+
+            for get_frac in "${WORKLOADS[@]}"; do
+                for clients in "${CLIENT_SWEEP[@]}"; do
+                    run_workload "$protocol" "$clients" "$get_frac" "$N" "$read_q" "$write_q"
+                done
+            done
+        done
+    done
+
+    # large values: bytes per second rather than ops per second, on the
+    # N=3 servers still up from above
+    N=3
+    for V in "${VALUE_SIZE_SWEEP[@]}"; do
+        for get_frac in "${WORKLOADS[@]}"; do
+            for clients in "${VALUE_SWEEP_CLIENTS[@]}"; do
+                run_workload "$protocol" "$clients" "$get_frac" "$N" "" "" 1 "$V"
+            done
+        done
+    done
+
+    # many clients: coroutine mode on fresh N=3 servers
+    for ((i=0; i<N; i++)); do
+        fuser -k "$(port_for "$N" "$i")"/tcp 2>/dev/null || true
+    done
+    sleep 1
+    launch_servers "$protocol" "$N" "${COROUTINE_SERVER_OPTS[@]}"
+
+    for get_frac in "${WORKLOADS[@]}"; do
+        for clients in "${COROUTINE_CLIENT_SWEEP[@]}"; do
+            run_workload "$protocol" "$clients" "$get_frac" "$N" "" "" 1 "" "$COROUTINE_LOOPS"
+        done
+    done
+
+    # partitioned: each key lives on one group of 3 with majority quorums
+    for G in "${GROUP_SWEEP[@]}"; do
+        N=$((3 * G))
+        launch_servers "$protocol" "$N"
+
         for get_frac in "${WORKLOADS[@]}"; do
             for clients in "${CLIENT_SWEEP[@]}"; do
-                run_workload "$protocol" "$clients" "$get_frac" "$N"
+                run_workload "$protocol" "$clients" "$get_frac" "$N" "" "" "$G"
             done
         done
     done
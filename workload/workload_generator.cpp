@@ -1,7 +1,18 @@
 #include "../common/types.h"
+#include "../common/async.h"
 #include "../common/network.h"
 #include "../abd/abd_client.h"
 #include "../blocking/blocking_client.h"
+#include "../abd/abd_replica.h"
+#include "../abd/anti_entropy.h"
+#include "../blocking/blocking_replica.h"
+#include "../common/sim_transport.h"
+#include "../common/trace.h"
+#include "../common/protocol.h"
+#include "../common/health.h"
+#include "../common/hedge.h"
+#include "../common/single_flight.h"
+#include "../common/partition.h"
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -9,23 +20,71 @@
 #include <atomic>
 #include <chrono>
 #include <algorithm>
+#include <iomanip>
 #include <mutex>
+#include <map>
+#include <set>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <functional>
+#include <sys/resource.h>
 
 using namespace std;
 
-// Function pointer types for protocol abstraction
-typedef bool (*GetFunc)(const string&, int, const vector<ServerInfo>&, string&);
-typedef bool (*PutFunc)(const string&, const string&, int, const vector<ServerInfo>&);
+// A protocol as the workers see it. Its operations are awaitable: a client
+// on its own thread runs each one to completion in place, while coroutine
+// clients interleave theirs on a few event loops.
+class ProtocolClient {
+public:
+    virtual ~ProtocolClient() = default;
+    virtual Async::Task<bool> get(const string &key, int client_id, const Partition::Groups &groups, string &out) = 0;
+    virtual Async::Task<bool> put(const string &key, const string &value, int client_id, const Partition::Groups &groups) = 0;
+};
+
+class AbdClient : public ProtocolClient {
+public:
+    AbdClient(ABD::Quorums q, bool on_loop) : q(q), on_loop(on_loop) {}
+
+    Async::Task<bool> get(const string &key, int client_id, const Partition::Groups &groups, string &out) override {
+        if (on_loop) co_return co_await ABD::get_async(key, client_id, groups, q, out);
+        co_return ABD::get(key, client_id, groups, q, out);
+    }
+    Async::Task<bool> put(const string &key, const string &value, int client_id, const Partition::Groups &groups) override {
+        if (on_loop) co_return co_await ABD::put_async(key, value, client_id, groups, q);
+        co_return ABD::put(key, value, client_id, groups, q);
+    }
+
+private:
+    ABD::Quorums q;
+    bool on_loop;
+};
+
+class BlockingClient : public ProtocolClient {
+public:
+    explicit BlockingClient(bool on_loop) : on_loop(on_loop) {}
+
+    Async::Task<bool> get(const string &key, int client_id, const Partition::Groups &groups, string &out) override {
+        if (on_loop) co_return co_await Blocking::get_async(key, client_id, groups, out);
+        co_return Blocking::get(key, client_id, groups, out);
+    }
+    Async::Task<bool> put(const string &key, const string &value, int client_id, const Partition::Groups &groups) override {
+        if (on_loop) co_return co_await Blocking::put_async(key, value, client_id, groups);
+        co_return Blocking::put(key, value, client_id, groups);
+    }
+
+private:
+    bool on_loop;
+};
 
 struct WorkerParams {
     int client_id;
     int ops;
     double get_fraction;
     int num_keys;
-    const vector<ServerInfo>*servers;
+    const Partition::Groups *groups;
     
-    GetFunc get_func;
-    PutFunc put_func;
+    ProtocolClient *client;
     
     atomic<long long> *succ_get;
     atomic<long long> *succ_put;
@@ -34,29 +93,47 @@ struct WorkerParams {
     vector<double> *get_latencies;
     vector<double> *put_latencies;
     mutex *lat_lock;
+
+    unsigned long long seed;    // 0 draws from random_device
+
+    // share of ops on keys this client owns ("c<id>/key<k>", abd only)
+    double owned_fraction = 0;
+    vector<double> *owned_put_latencies = nullptr;
+
+    // PUT values are padded to this many bytes; value_bytes sums the
+    // values moved by successful ops
+    int value_size = 0;
+    atomic<long long> *value_bytes = nullptr;
 };
 
+// Prefix of the keys owned by client_id under --owned
+static string owned_prefix(int client_id) {
+    return "c" + to_string(client_id) + "/";
+}
+
 
 // Used some c++ libraries: random_device and mt19937
 // to generate random distributions for get and put
-void worker_func(WorkerParams p) {
+Async::Task<void> worker(WorkerParams p) {
     random_device rd;
-    mt19937 rng(rd() ^ (static_cast<unsigned long long>(p.client_id) * 0x9e3779b97f4a7c15ULL));
+    unsigned long long base = p.seed ? p.seed : rd();
+    mt19937 rng(base ^ (static_cast<unsigned long long>(p.client_id) * 0x9e3779b97f4a7c15ULL));
 
     uniform_real_distribution<double> r01(0.0, 1.0);
     uniform_int_distribution<int> key_dist(0, p.num_keys - 1);
     uniform_int_distribution<int> val_dist(0, 999999);
 
     for (int i = 0; i < p.ops; i++) {
-        string key = "key" + to_string(key_dist(rng));
+        bool owned = p.owned_fraction > 0 && r01(rng) < p.owned_fraction;
+        string key = (owned ? owned_prefix(p.client_id) : "") + "key" + to_string(key_dist(rng));
         double x = r01(rng);
 
         if (x < p.get_fraction) {
             // GET operation
-            auto start = chrono::steady_clock::now();
+            auto start = Network::now();
             string val;
-            bool ok = p.get_func(key, p.client_id, *p.servers, val);
-            auto end = chrono::steady_clock::now();
+            bool ok = co_await p.client->get(key, p.client_id, *p.groups, val);
+            auto end = Network::now();
             
             double us = chrono::duration_cast<chrono::microseconds>(end - start).count();
 
@@ -65,25 +142,32 @@ void worker_func(WorkerParams p) {
                 p.get_latencies->push_back(us);
             }
 
-            if (ok) p.succ_get->fetch_add(1);
+            if (ok) {
+                p.succ_get->fetch_add(1);
+                p.value_bytes->fetch_add(val.size());
+            }
             else p.fail->fetch_add(1);
 
         } else {
             // PUT operation
             string value = "v" + to_string(p.client_id) + "_" + to_string(val_dist(rng));
+            if ((int)value.size() < p.value_size) value.resize(p.value_size, 'x');
 
-            auto start = chrono::steady_clock::now();
-            bool ok = p.put_func(key, value, p.client_id, *p.servers);
-            auto end = chrono::steady_clock::now();
+            auto start = Network::now();
+            bool ok = co_await p.client->put(key, value, p.client_id, *p.groups);
+            auto end = Network::now();
 
             double us = chrono::duration_cast<chrono::microseconds>(end - start).count();
 
             {
                 lock_guard<mutex> guard(*p.lat_lock);
-                p.put_latencies->push_back(us);
+                (owned ? p.owned_put_latencies : p.put_latencies)->push_back(us);
             }
 
-            if(ok) p.succ_put->fetch_add(1);
+            if(ok) {
+                p.succ_put->fetch_add(1);
+                p.value_bytes->fetch_add(value.size());
+            }
             else p.fail->fetch_add(1);
         }
     }
@@ -96,33 +180,315 @@ double percentile(vector<double> &v, double p) {
     return v[idx];
 }
 
+static const char *PHASE_NAMES[Trace::NUM_PHASES] = {"LOCK", "READ", "WRITE", "UNLOCK"};
+
+// Per-phase latency and per-replica RPC breakdown of the traced ops
+static void print_trace_summary(const vector<Trace::OpTrace> &ops, const Partition::Groups &groups) {
+    cout << "\n--- Phase breakdown (microseconds) ---\n";
+    for (int kind : {Trace::GET, Trace::PUT}) {
+        for (int ph = 0; ph < Trace::NUM_PHASES; ph++) {
+            vector<double> durs, connects;
+            for (auto &op : ops) {
+                if (op.kind != kind || !op.phases[ph].used) continue;
+                durs.push_back(op.phases[ph].dur_us);
+                for (auto &rpc : op.phases[ph].rpcs) {
+                    if (rpc.replica >= 0) connects.push_back(rpc.connect_us);
+                }
+            }
+            if (durs.empty()) continue;
+            cout << (kind == Trace::GET ? "GET " : "PUT ") << left << setw(7) << PHASE_NAMES[ph] << right
+                 << " median: " << percentile(durs, 0.50)
+                 << "  p95: " << percentile(durs, 0.95)
+                 << "  connect median: " << percentile(connects, 0.50) << "\n";
+        }
+    }
+
+    // a replica is the straggler of a phase when its RPC finished last;
+    // traces hold the replica's index within the op's group
+    struct ReplicaRpcs {
+        vector<double> rpc_us, connect_us;
+        long long straggles = 0, failures = 0;
+    };
+    vector<vector<ReplicaRpcs>> table(groups.size());
+    for (int g = 0; g < groups.size(); g++) table[g].resize(groups.group(g).size());
+    long long contested = 0;
+    for (auto &op : ops) {
+        if (op.group < 0 || op.group >= groups.size()) continue;
+        vector<ReplicaRpcs> &replicas = table[op.group];
+        int n = replicas.size();
+        for (auto &ph : op.phases) {
+            if (!ph.used) continue;
+            for (auto &rpc : ph.rpcs) {
+                int r = rpc.replica;
+                if (r < 0 || r >= n) continue;
+                replicas[r].rpc_us.push_back(rpc.total_us);
+                replicas[r].connect_us.push_back(rpc.connect_us);
+                if (!rpc.ok) replicas[r].failures++;
+            }
+            int slow = ph.straggler();
+            if (ph.rpcs.size() > 1 && slow >= 0 && ph.rpcs[slow].replica < n) {
+                replicas[ph.rpcs[slow].replica].straggles++;
+                contested++;
+            }
+        }
+    }
+
+    cout << "\n--- Per-replica RPC (microseconds) ---\n";
+    for (int g = 0; g < groups.size(); g++) {
+        for (int r = 0; r < (int)table[g].size(); r++) {
+            ReplicaRpcs &rr = table[g][r];
+            const ServerInfo &srv = groups.group(g)[r];
+            if (groups.size() > 1) cout << "group " << g << " ";
+            cout << "replica " << r << " (" << srv.host << ":" << srv.port << ")"
+                 << "  rpcs: " << rr.rpc_us.size()
+                 << "  failed: " << rr.failures
+                 << "  median: " << percentile(rr.rpc_us, 0.50)
+                 << "  p95: " << percentile(rr.rpc_us, 0.95)
+                 << "  connect median: " << percentile(rr.connect_us, 0.50)
+                 << "  straggler: " << rr.straggles
+                 << " (" << (contested ? 100.0 * rr.straggles / contested : 0.0) << "%)\n";
+        }
+    }
+    if (Trace::overwritten() > 0) {
+        cout << "(" << Trace::overwritten() << " oldest ops dropped from the trace buffers)\n";
+    }
+}
+
+// One CSV row per replica RPC, with its op and phase
+static bool export_trace(const string &path, const vector<Trace::OpTrace> &ops) {
+    ofstream out(path);
+    if (!out) return false;
+
+    out << "op,client_id,kind,op_ok,op_us,phase,phase_offset_us,phase_us,group,replica,connect_us,rpc_us,rpc_ok,straggler\n";
+    for (size_t i = 0; i < ops.size(); i++) {
+        const auto &op = ops[i];
+        for (int ph = 0; ph < Trace::NUM_PHASES; ph++) {
+            const auto &pt = op.phases[ph];
+            if (!pt.used) continue;
+            int slow = pt.straggler();
+            for (int k = 0; k < (int)pt.rpcs.size(); k++) {
+                const auto &rpc = pt.rpcs[k];
+                if (rpc.replica < 0) continue;
+                out << i << "," << op.client_id << "," << (op.kind == Trace::GET ? "GET" : "PUT") << ","
+                    << op.ok << "," << op.total_us << "," << PHASE_NAMES[ph] << ","
+                    << pt.offset_us << "," << pt.dur_us << "," << op.group << "," << rpc.replica << ","
+                    << rpc.connect_us << "," << rpc.total_us << "," << rpc.ok << ","
+                    << (k == slow) << "\n";
+            }
+        }
+    }
+    return true;
+}
+
+// Ask every replica for its STATS line
+static void print_server_stats(const vector<ServerInfo> &servers) {
+    cout << "\n--- Server stats ---\n";
+    for (size_t r = 0; r < servers.size(); r++) {
+        string resp;
+        int sock = Network::connect_to_server(servers[r]);
+        if (sock >= 0) {
+            Network::send_message(sock, Protocol::stats_req());
+            resp = Network::recv_line(sock);
+            Network::disconnect(sock);
+        }
+        cout << "replica " << r << ": " << (resp.empty() ? "unavailable" : resp) << "\n";
+    }
+}
+
+// Split "--name value" options from positional arguments
+static map<string, string> parse_options(int argc, char *argv[], vector<string> &positional) {
+    map<string, string> opts;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a.rfind("--", 0) == 0 && i + 1 < argc) {
+            opts[a.substr(2)] = argv[++i];
+        } else {
+            positional.push_back(a);
+        }
+    }
+    return opts;
+}
+
+// Build the in-process replicas for --sim and route all client traffic to them
+static unique_ptr<Network::SimTransport> setup_sim(const string &protocol, int n, map<string, string> &opts,
+                                                  vector<ServerInfo> &servers,
+                                                  vector<unique_ptr<ABD::Replica>> &abd_replicas,
+                                                  vector<unique_ptr<Blocking::Replica>> &blocking_replicas)
+{
+    uint64_t seed = opts.count("seed") ? stoull(opts["seed"]) : 1;
+    auto sim = make_unique<Network::SimTransport>(seed);
+
+    // --link takes one model per replica, the last one repeats
+    vector<Network::LinkModel> links;
+    istringstream specs(opts.count("link") ? opts["link"] : "exp:50:20");
+    string spec;
+    while (getline(specs, spec, ',')) {
+        Network::LinkModel lm;
+        if (!Network::parse_link_model(spec, lm)) {
+            cout << "Invalid link model '" << spec << "'\n";
+            return nullptr;
+        }
+        if (opts.count("drop")) lm.drop_rate = stod(opts["drop"]);
+        links.push_back(lm);
+    }
+
+    // --slow i:us[,i:us...] adds service time to replica i
+    map<int, double> slow;
+    istringstream slows(opts.count("slow") ? opts["slow"] : "");
+    while (getline(slows, spec, ',')) {
+        auto pos = spec.find(':');
+        if (pos == string::npos) continue;
+        slow[stoi(spec.substr(0, pos))] = stod(spec.substr(pos + 1));
+    }
+
+    // --pause i:every_us:us[,...] stalls replica i for us out of every every_us
+    map<int, pair<double, double>> pauses;
+    istringstream pause_specs(opts.count("pause") ? opts["pause"] : "");
+    while (getline(pause_specs, spec, ',')) {
+        istringstream fields(spec);
+        string idx, every, dur;
+        getline(fields, idx, ':');
+        getline(fields, every, ':');
+        getline(fields, dur, ':');
+        if (idx.empty() || every.empty() || dur.empty()) continue;
+        pauses[stoi(idx)] = {stod(every), stod(dur)};
+    }
+
+    for (int i = 0; i < n; i++) {
+        Network::ReplicaModel model;
+        model.link = links[min(i, (int)links.size() - 1)];
+        if (opts.count("service-us")) model.service_us = stod(opts["service-us"]);
+        if (slow.count(i)) model.service_us += slow[i];
+        if (pauses.count(i)) {
+            model.pause_every_us = pauses[i].first;
+            model.pause_us = pauses[i].second;
+        }
+
+        ServerInfo addr{"sim", i};
+        Network::SimHandler handler;
+        if (protocol == "abd") {
+            abd_replicas.push_back(make_unique<ABD::Replica>());
+            ABD::Replica *r = abd_replicas.back().get();
+            handler = [r](const string &msg) { return r->handle_request(msg).str(); };
+        } else {
+            blocking_replicas.push_back(make_unique<Blocking::Replica>());
+            Blocking::Replica *r = blocking_replicas.back().get();
+            handler = [r](const string &msg) { return r->handle_request(msg).str(); };
+        }
+        sim->add_replica(addr, handler, model);
+        servers.push_back(addr);
+    }
+
+    Network::set_transport(sim.get());
+    return sim;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 7) {
+    vector<string> args;
+    map<string, string> opts = parse_options(argc, argv, args);
+    bool use_sim = opts.count("sim") > 0;
+
+    if (args.size() < 5 || (!use_sim && args.size() < 6)) {
         cout << "Usage:\n";
-        cout << "./workload <protocol> <num_clients> <ops_per_client> <get_fraction> <num_keys> <ip:port>...\n";
+        cout << "./workload <protocol> <num_clients> <ops_per_client> <get_fraction> <num_keys> <ip:port>... [options]\n";
         cout << "  protocol: 'abd' or 'blocking'\n";
+        cout << "Simulation options (replace <ip:port>...):\n";
+        cout << "  --sim <N>             run against N in-process replicas on a virtual clock\n";
+        cout << "  --seed <S>            scheduler seed (default 1)\n";
+        cout << "  --link <model,...>    per-replica one-way latency in us: const:<base>,\n";
+        cout << "                        uniform:<base>:<width> or exp:<base>:<mean> (default exp:50:20),\n";
+        cout << "                        each optionally followed by :<drop_rate> (1 = unreachable)\n";
+        cout << "  --drop <p>            per-message drop probability on every link\n";
+        cout << "  --service-us <us>     replica service time per request (default 5)\n";
+        cout << "  --slow <i:us,...>     extra service time for replica i\n";
+        cout << "  --pause <i:every:us,...>  replica i stalls for us out of every every us\n";
+        cout << "Partitioning options:\n";
+        cout << "  --groups <G>          split the replicas into G equal groups and route each\n";
+        cout << "                        key to one by consistent hashing (default 1)\n";
+        cout << "  --vnodes <V>          ring points per group (default " << Partition::DEFAULT_VNODES << ")\n";
+        cout << "Quorum options (abd):\n";
+        cout << "  --read-quorum <R>     replicas per read/query phase (default majority)\n";
+        cout << "  --write-quorum <W>    replicas per write phase (default majority);\n";
+        cout << "                        requires R + W > N and W > N/2\n";
+        cout << "  --owned <f>           share of each client's ops on keys it alone writes\n";
+        cout << "                        (single-writer mode, one-round-trip PUT)\n";
+        cout << "  --coalesce on         share one quorum read among concurrent GETs of a key\n";
+        cout << "  --anti-entropy-ms <ms>  with --sim, replicas reconcile with each other this often\n";
+        cout << "Hedging options:\n";
+        cout << "  --hedge <pct|off>     hedge quorum phases still short after the pct-th\n";
+        cout << "                        percentile of recent RPC latency (default off);\n";
+        cout << "                        ABD only, blocking never hedges its locks\n";
+        cout << "  --hedge-budget <f>    hedges allowed per ordinary RPC (default 0.05)\n";
+        cout << "Client options:\n";
+        cout << "  --pin-clients on      pin client thread i to core i (wrapping around)\n";
+        cout << "  --coroutines <L>      run the clients as coroutines on L event-loop threads\n";
+        cout << "                        instead of a thread each (rejected with --sim,\n";
+        cout << "                        --coalesce, --hedge and tracing); --pin-clients pins the loops\n";
+        cout << "  --value-size <bytes>  pad PUT values to this size and report MB/s of values\n";
+        cout << "Tracing options:\n";
+        cout << "  --trace <on|off>      per-phase client tracing (default off)\n";
+        cout << "  --trace-out <file>    export per-replica RPC timings as CSV (turns tracing on)\n";
+        cout << "  --server-stats on     print each replica's STATS after the run\n";
+        return 1;
+    }
+
+    string protocol = args[0];
+    int num_clients = stoi(args[1]);
+    int ops = stoi(args[2]);
+    double get_frac = stod(args[3]);
+    int num_keys = stoi(args[4]);
+
+    // --coroutines L runs the clients on L event-loop threads
+    int loops = opts.count("coroutines") ? stoi(opts["coroutines"]) : 0;
+    if (loops < 0) {
+        cout << "--coroutines needs a loop count of at least 1\n";
         return 1;
     }
+    if (loops > 0) {
+        // the coroutine paths talk to sockets directly and run many ops on
+        // one thread, so anything that hangs off the client threads is out
+        const char *why = nullptr;
+        if (use_sim)
+            why = "--sim: the simulated network runs each exchange on a thread of its own";
+        else if (opts.count("coalesce") && opts["coalesce"] == "on")
+            why = "--coalesce: followers would block their loop's thread waiting on the leader";
+        else if (opts.count("hedge") && opts["hedge"] != "off")
+            why = "--hedge: coroutine phases are not hedged";
+        else if ((opts.count("trace") && opts["trace"] == "on") || opts.count("trace-out"))
+            why = "--trace/--trace-out: traces follow the current op of a thread, which coroutines share";
+        if (why) {
+            cout << "--coroutines cannot be combined with " << why << "\n";
+            return 1;
+        }
+    }
 
-    string protocol = argv[1];
-    int num_clients = stoi(argv[2]);
-    int ops = stoi(argv[3]);
-    double get_frac = stod(argv[4]);
-    int num_keys = stoi(argv[5]);
+    // Select protocol client
+    unique_ptr<ProtocolClient> client;
 
-    // Select protocol functions
-    GetFunc get_func;
-    PutFunc put_func;
+    // quorums are formed within a group
+    int num_groups = opts.count("groups") ? stoi(opts["groups"]) : 1;
+    int total_replicas = use_sim ? stoi(opts["sim"]) : (int)args.size() - 5;
+    if (num_groups < 1 || total_replicas % num_groups != 0) {
+        cout << "--groups must divide the " << total_replicas << " replicas evenly\n";
+        return 1;
+    }
+    int num_replicas = total_replicas / num_groups;
+    ABD::Quorums quorums;
+    if (opts.count("read-quorum")) quorums.read = stoi(opts["read-quorum"]);
+    if (opts.count("write-quorum")) quorums.write = stoi(opts["write-quorum"]);
 
     if (protocol == "abd") 
     {
-        get_func = ABD::get;
-        put_func = ABD::put;
+        string err;
+        if (!ABD::check_quorums(quorums, num_replicas, err)) {
+            cout << "Unsafe quorums: " << err << "\n";
+            return 1;
+        }
+        client = make_unique<AbdClient>(quorums, loops > 0);
     }
     else if (protocol == "blocking") 
     {
-        get_func = Blocking::get;
-        put_func = Blocking::put;
+        client = make_unique<BlockingClient>(loops > 0);
     }
     else 
     {
@@ -130,33 +496,140 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (protocol != "abd" && (quorums.read || quorums.write)) {
+        cout << "--read-quorum and --write-quorum only apply to abd\n";
+        return 1;
+    }
+
+    int anti_entropy_ms = opts.count("anti-entropy-ms") ? stoi(opts["anti-entropy-ms"]) : 0;
+    if (anti_entropy_ms > 0 && (protocol != "abd" || !use_sim)) {
+        cout << "--anti-entropy-ms only applies to abd with --sim\n";
+        return 1;
+    }
+
+    double owned_fraction = opts.count("owned") ? stod(opts["owned"]) : 0;
+    if (protocol != "abd" && owned_fraction > 0) {
+        cout << "--owned only applies to abd\n";
+        return 1;
+    }
+
     vector<ServerInfo>servers;
-    for (int i=6; i<argc; i++) {
-        servers.push_back(Network::parse_server(argv[i]));
+    vector<unique_ptr<ABD::Replica>> abd_replicas;
+    vector<unique_ptr<Blocking::Replica>> blocking_replicas;
+    unique_ptr<Network::SimTransport> sim;
+
+    if (use_sim) {
+        sim = setup_sim(protocol, stoi(opts["sim"]), opts, servers, abd_replicas, blocking_replicas);
+        if (!sim) return 1;
+    } else {
+        for (size_t i = 5; i < args.size(); i++) {
+            servers.push_back(Network::parse_server(args[i]));
+        }
     }
 
-    atomic<long long> succ_get{0}, succ_put{0}, fail{0};
+    vector<vector<ServerInfo>> group_servers;
+    Partition::split(servers, num_groups, group_servers);
+    Partition::Groups groups(group_servers, opts.count("vnodes") ? stoi(opts["vnodes"]) : Partition::DEFAULT_VNODES);
+
+    atomic<long long> succ_get{0}, succ_put{0}, fail{0}, value_bytes{0};
+    int value_size = opts.count("value-size") ? stoi(opts["value-size"]) : 0;
     vector<double> get_latencies;
     vector<double> put_latencies;
+    vector<double> owned_put_latencies;
     mutex lat_lock;
+    atomic<int> owner_failures{0};
+    bool pin_clients = opts.count("pin-clients") && opts["pin-clients"] == "on";
+    atomic<int> pin_failures{0};
+
+    Trace::set_enabled((opts.count("trace") && opts["trace"] == "on") || opts.count("trace-out"));
+    SingleFlight::set_enabled(opts.count("coalesce") && opts["coalesce"] == "on");
+
+    Hedge::Policy hedge;
+    if (opts.count("hedge") && opts["hedge"] != "off") {
+        hedge.enabled = true;
+        hedge.percentile = stod(opts["hedge"]);
+    }
+    if (opts.count("hedge-budget")) hedge.budget = stod(opts["hedge-budget"]);
+    Hedge::configure(hedge);
 
-    vector<thread>threads;
+    // simulated runs are reproducible end to end, including the op mix
+    unsigned long long seed = use_sim && opts.count("seed") ? stoull(opts["seed"]) : 0;
+
+    // each simulated replica syncs with the rest of its group while the
+    // clients run
+    vector<unique_ptr<ABD::AntiEntropy>> syncers;
+    for (size_t i = 0; anti_entropy_ms > 0 && i < abd_replicas.size(); i++) {
+        vector<ServerInfo> peers;
+        for (size_t j = 0; j < servers.size(); j++) {
+            if (j != i && j / num_replicas == i / num_replicas) peers.push_back(servers[j]);
+        }
+        syncers.push_back(make_unique<ABD::AntiEntropy>(*abd_replicas[i], peers, anti_entropy_ms));
+        syncers.back()->start();
+    }
 
-    auto t0 = chrono::steady_clock::now();
+    Health::start_prober();
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::time_point::max();
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::time_point::min();
 
-    for (int i = 0; i < num_clients; i++) {
-        WorkerParams p{i+1, ops, get_frac, num_keys, &servers,
-            get_func, put_func,
+    // client i, after declaring its owned prefixes
+    auto setup_client = [&](int i) {
+        WorkerParams p{i+1, ops, get_frac, num_keys, &groups,
+            client.get(),
             &succ_get, &succ_put, &fail,
-            &get_latencies, &put_latencies, &lat_lock
+            &get_latencies, &put_latencies, &lat_lock,
+            seed
         };
-        threads.emplace_back(worker_func, p);
-    }
+        p.owned_fraction = owned_fraction;
+        p.owned_put_latencies = &owned_put_latencies;
+        p.value_size = value_size;
+        p.value_bytes = &value_bytes;
+
+        // owned keys hash to every group
+        for (int g = 0; owned_fraction > 0 && g < groups.size(); g++) {
+            if (!ABD::declare_owner(owned_prefix(i+1), i+1, groups.group(g))) owner_failures++;
+        }
+        return p;
+    };
+
+    // the clients read the clock themselves: outside of them the
+    // simulated clock keeps moving for the prober
+    auto timed_worker = [&](WorkerParams p) -> Async::Task<void> {
+        auto start = Network::now();
+        co_await worker(p);
+        auto end = Network::now();
+
+        lock_guard<mutex> guard(lat_lock);
+        t0 = min(t0, start);
+        t1 = max(t1, end);
+    };
+
+    if (loops == 0) {
+        Network::fan_out(num_clients, [&](int i) {
+            if (pin_clients && !Network::pin_to_core(i)) pin_failures++;
+            Async::run(timed_worker(setup_client(i)));
+        });
+    } else {
+        // every client keeps up to N sockets open
+        rlimit files;
+        if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+            files.rlim_cur = files.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &files);
+        }
+
+        // clients are dealt round-robin to the loops and all start at once
+        Network::fan_out(loops, [&](int t) {
+            if (pin_clients && !Network::pin_to_core(t)) pin_failures++;
+            vector<WorkerParams> mine;
+            for (int i = t; i < num_clients; i += loops) mine.push_back(setup_client(i));
 
-    for (auto &t:threads)
-        t.join();
+            Async::Loop loop;
+            for (auto &p : mine) loop.spawn(timed_worker(p));
+            loop.run();
+        });
+    }
 
-    auto t1 = chrono::steady_clock::now();
+    Health::stop_prober();
+    for (auto &s : syncers) s->stop();
     double elapsed = chrono::duration<double>(t1-t0).count();
     long long total_ops = (long long)num_clients*ops;
 
@@ -166,14 +639,111 @@ int main(int argc, char *argv[]) {
     cout << "  FAIL count:  " << fail << "\n";
     cout << "  Total ops attempted:      " << total_ops << "\n";
     cout << "  Total ops succeeded:      " << (succ_get + succ_put) << "\n";
+    if (num_groups > 1) {
+        cout << "  Groups:      " << num_groups << " x " << num_replicas << " replicas\n";
+    }
+    if (protocol == "abd") {
+        cout << "  Quorums:     R=" << ABD::read_quorum(quorums, num_replicas)
+             << " W=" << ABD::write_quorum(quorums, num_replicas) << " of N=" << num_replicas << "\n";
+        if (Trace::enabled()) {
+            long long gets = 0, fast = 0;
+            for (auto &op : Trace::collect()) {
+                if (op.kind != Trace::GET || !op.ok) continue;
+                gets++;
+                if (!op.phases[Trace::WRITE].used) fast++;
+            }
+            cout << "  GETs without write-back: " << fast << " of " << gets << "\n";
+        }
+    }
+    if (loops > 0) cout << "  Clients:     " << num_clients << " coroutines on " << loops << " loop threads\n";
+    if (pin_failures) cout << (loops > 0 ? "  Loops not pinned: " : "  Clients not pinned: ") << pin_failures << "\n";
     cout << "  Elapsed:     " << elapsed << " sec\n";
-    cout << "  Throughput:  " << ((succ_get + succ_put) / elapsed) << " ops/sec\n\n";
+    cout << "  Throughput:  " << ((succ_get + succ_put) / elapsed) << " ops/sec\n";
+    if (value_size > 0) {
+        cout << "  Value size:  " << value_size << " bytes\n";
+        cout << "  Value MB/s:  " << (value_bytes / elapsed / 1e6) << "\n";
+    }
+    cout << "\n";
 
     cout << "--- Latency (microseconds) ---\n";
     cout << "GET median: " << percentile(get_latencies, 0.50) << "\n";
     cout << "GET p95:    " << percentile(get_latencies, 0.95) << "\n";
+    cout << "GET p99:    " << percentile(get_latencies, 0.99) << "\n";
     cout << "PUT median: " << percentile(put_latencies, 0.50) << "\n";
     cout << "PUT p95:    " << percentile(put_latencies, 0.95) << "\n";
+    cout << "PUT p99:    " << percentile(put_latencies, 0.99) << "\n";
+    if (owned_fraction > 0) {
+        cout << "Owned PUT median: " << percentile(owned_put_latencies, 0.50) << "\n";
+        cout << "Owned PUT p95:    " << percentile(owned_put_latencies, 0.95) << "\n";
+        cout << "Owned PUT p99:    " << percentile(owned_put_latencies, 0.99) << "\n";
+        if (owner_failures) cout << "Ownership declarations failed: " << owner_failures << "\n";
+    }
+
+    if (Trace::enabled()) {
+        auto traced = Trace::collect();
+        print_trace_summary(traced, groups);
+        if (opts.count("trace-out")) {
+            if (export_trace(opts["trace-out"], traced)) cout << "Trace written to " << opts["trace-out"] << "\n";
+            else cout << "Could not write trace to " << opts["trace-out"] << "\n";
+        }
+    }
+
+    if (SingleFlight::enabled()) {
+        auto sf = SingleFlight::counters();
+        cout << "\n--- GET coalescing ---\n";
+        cout << "GETs: " << sf.calls << "  quorum reads: " << sf.flights
+             << "  (" << (sf.flights ? (double)sf.calls / sf.flights : 0.0) << " GETs per read)\n";
+    }
+
+    if (!syncers.empty()) {
+        long long rounds = 0, ranges = 0, pushed = 0, pulled = 0;
+        vector<set<uint64_t>> roots(num_groups);
+        for (size_t i = 0; i < abd_replicas.size(); i++) {
+            auto &r = abd_replicas[i];
+            rounds += r->stats().total(Stats::SYNC_ROUNDS);
+            ranges += r->stats().total(Stats::SYNC_RANGES_REPAIRED);
+            pushed += r->stats().total(Stats::SYNC_KEYS_PUSHED);
+            pulled += r->stats().total(Stats::SYNC_KEYS_PULLED);
+            roots[i / num_replicas].insert(r->root_digest());
+        }
+        bool in_sync = all_of(roots.begin(), roots.end(), [](const set<uint64_t> &g) { return g.size() == 1; });
+        cout << "\n--- Anti-entropy ---\n";
+        cout << "Rounds: " << rounds << "  ranges repaired: " << ranges
+             << "  keys pushed: " << pushed << "  keys pulled: " << pulled << "\n";
+        cout << "Replicas in sync at end: " << (in_sync ? "yes" : "no") << "\n";
+    }
+
+    if (hedge.enabled) {
+        auto hc = Hedge::counters();
+        cout << "\n--- Hedging ---\n";
+        cout << "Policy: p" << hedge.percentile << " delay, budget " << hedge.budget << "\n";
+        cout << "RPCs: " << hc.rpcs << "  hedges: " << hc.hedges
+             << " (" << (hc.rpcs ? 100.0 * hc.hedges / hc.rpcs : 0.0) << "% extra load)"
+             << "  won: " << hc.wins
+             << "  over budget: " << hc.denied << "\n";
+    }
+
+    cout << "\n--- Replica health ---\n";
+    for (auto &h : Health::snapshot()) {
+        cout << h.srv.host << ":" << h.srv.port
+             << "  srtt_us: " << h.srtt_us
+             << "  rttvar_us: " << h.rttvar_us
+             << "  rto_us: " << h.rto_us
+             << "  failures: " << h.failures
+             << (h.suspect ? "  SUSPECT" : "") << "\n";
+    }
+
+    if (opts.count("server-stats") && opts["server-stats"] == "on") {
+        print_server_stats(servers);
+    }
+
+    if (sim) {
+        cout << "\n--- Simulation (virtual time) ---\n";
+        cout << "Messages delivered: " << sim->messages_delivered() << "\n";
+        cout << "Messages dropped:   " << sim->messages_dropped() << "\n";
+        cout << "Recv timeouts:      " << sim->timeouts() << "\n";
+        Network::set_transport(nullptr);
+    }
 
     return 0;
 }
\ No newline at end of file